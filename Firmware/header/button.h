@@ -0,0 +1,24 @@
+#ifndef BUTTON_H
+#define	BUTTON_H
+
+// Button states
+#define BUTTON_IDLE 0
+#define BUTTON_PRESSED 1
+#define BUTTON_HELD 2
+#define BUTTON_SELECT 3
+
+// Button events
+#define BUTTON_EVENT_NONE 0
+#define BUTTON_EVENT_SHORT 1
+#define BUTTON_EVENT_LONG 2
+#define BUTTON_EVENT_EXTRA_LONG 3
+
+extern volatile uint8_t button_state;
+extern volatile uint8_t button_event;
+extern volatile uint32_t button_edge;
+
+uint8_t button_take(void);
+void button_init(void);
+
+#endif	/* BUTTON_H */
+
@@ -1,7 +1,19 @@
 #ifndef FLASH_H
 #define	FLASH_H
 
+#define FLASH_SIZE 0x1000000UL // W25Q128, 16 MB
+
+extern uint32_t flash_size;
+extern uint16_t flash_page;
+extern uint8_t flash_erase_cmd;
+
+uint8_t flash_init(void);
+void flash_command(uint8_t command, uint32_t address);
 uint8_t flash_write_enable(void);
+void flash_erase(uint32_t address);
+uint8_t flash_busy(void);
+uint8_t flash_suspend(void);
+void flash_resume(void);
 uint8_t flash_wait(void);
 
 #endif	/* FLASH_H */
@@ -1,9 +1,20 @@
 #ifndef GPIO_H
 #define	GPIO_H
 
+// TPL5110 DONE is tied to ground on Rev 1.1 boards, uncomment after wiring it to a PORTB pin
+//#define GPIO_DONE_PIN 3
+
+#ifdef GPIO_DONE_PIN
+#define GPIO_DONE_MASK (1 << GPIO_DONE_PIN)
+#else
+#define GPIO_DONE_MASK 0
+#endif
+
 uint8_t gpio_write(uint8_t port, uint8_t pin, uint8_t value);
 void dac_write(uint8_t value);
 void dac_enable(uint8_t en);
+void pwm_enable(uint8_t mask);
+void pwm_write(uint8_t channel, uint8_t duty);
 void gpio_init(void);
 
 #endif	/* GPIO_H */
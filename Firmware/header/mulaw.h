@@ -0,0 +1,7 @@
+#ifndef MULAW_H
+#define	MULAW_H
+
+extern const uint16_t mulaw_table[256];
+
+#endif	/* MULAW_H */
+
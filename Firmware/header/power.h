@@ -0,0 +1,10 @@
+#ifndef POWER_H
+#define	POWER_H
+
+extern volatile uint8_t power_activity;
+
+void power_init(void);
+void power_off(void);
+
+#endif	/* POWER_H */
+
@@ -0,0 +1,27 @@
+#ifndef STATE_H
+#define	STATE_H
+
+// Song load status
+#define STATE_UNKNOWN 0
+#define STATE_LOADING 1
+#define STATE_LOADED 2
+
+// Blocks (64 kB) programmed between saved load progress
+#define STATE_PROGRESS_BLOCKS 16
+
+// Persistent selection and load state, kept in EEPROM
+struct song_state {
+    uint8_t selected;   // Selected song number
+    uint8_t song;       // Song number in external flash
+    uint8_t status;     // Load status of song in external flash
+    uint16_t blocks;    // Blocks programmed when loading
+    uint32_t size;      // Song header, identifies loaded file
+};
+
+extern struct song_state song_state;
+
+void state_load(void);
+void state_save(void);
+
+#endif	/* STATE_H */
+
@@ -0,0 +1,27 @@
+#ifndef TIMER_H
+#define	TIMER_H
+
+// Timer clock is the Timer A prescaled clock, 39.0625 kHz (25.6 us per tick)
+#define TIMER_MS(ms) ((uint32_t) (ms) * 625 / 16)
+
+// Deadlines expire at least 2 ticks after they are scheduled, periodic timers run every 2 ticks or slower
+#define TIMER_MIN_TICKS 2
+
+// Timer slots
+#define TIMER_DELAY 0
+#define TIMER_DAC 1
+#define TIMER_DEBOUNCE 2
+#define TIMER_HOLD 3
+#define TIMER_IDLE 4
+#define TIMER_SLOTS 5
+
+void timer_init(void);
+uint32_t timer_ticks(void);
+void timer_start(uint8_t slot, uint32_t delay, uint32_t period, void (*callback)(void));
+void timer_stop(uint8_t slot);
+uint8_t timer_running(uint8_t slot);
+void timer_wait(uint8_t slot);
+void timer_delay(uint32_t delay);
+
+#endif	/* TIMER_H */
+
@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define	TRACE_H
+
+#include <stdint.h>
+
+// Uncomment to record SPI transactions into a RAM ring, adds about 20 CPU clocks to every SPI byte
+//#define SPI_TRACE
+
+#define TRACE_FLASH 0
+#define TRACE_SD 1
+#define TRACE_RECORDS 16 // Ring size, 12 bytes each
+
+// Chip select window on the SPI bus
+struct trace_record {
+    uint32_t time;      // Timer ticks at select
+    uint32_t address;   // Address after command, big-endian, 0 for flash commands without address
+    uint16_t length;    // Bytes clocked while selected, at most 0xFFFF
+    uint8_t device;
+    uint8_t command;    // First byte, for SD card first byte with start bits 01
+};
+
+// Ring of last records, read out with a UPDI debugger, e.g. pymcuprog reading the SRAM address of trace
+struct trace {
+    uint16_t count; // Records since reset, next record goes to count % TRACE_RECORDS
+    struct trace_record records[TRACE_RECORDS];
+};
+
+#ifdef SPI_TRACE
+extern struct trace trace;
+extern void (*trace_sink)(const struct trace_record *record); // Receives records instead of ring when set
+
+void trace_select(uint8_t device);
+void trace_byte(uint8_t value);
+void trace_deselect(uint8_t device);
+#else
+#define trace_select(device)
+#define trace_byte(value)
+#define trace_deselect(device)
+#endif
+
+#endif	/* TRACE_H */
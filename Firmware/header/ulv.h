@@ -0,0 +1,32 @@
+#ifndef ULV_H
+#define	ULV_H
+
+// Size field of header
+#define ULV_EXTENDED (1UL << 31)    // Extended header follows size field
+#define ULV_SIZE_MASK 0x7FFFFFFFUL
+#define ULV_LOADING 0xFF            // Highest size byte while song is loaded
+
+// Header flags
+#define ULV_HALF_RATE (1 << 0)      // Audio is stored at half the sample rate
+#define ULV_RLE (1 << 1)            // Audio byte 0 and a count repeat previous sample
+#define ULV_MULAW (1 << 2)          // Audio is mu-law companded
+#define ULV_PAGED (1 << 3)          // Frames fill 256-byte flash pages
+#define ULV_PWM (1 << 4)            // Mech bytes are followed by 3 PWM duties
+
+// ULV 1.0 defaults
+#define ULV_RATE 29840
+#define ULV_FRAME 1492
+
+// Audio samples per frame when frames fill flash pages
+#define ULV_PAGE_FRAME 255
+
+// Song header
+struct ulv_header {
+    uint32_t bytes;     // Data bytes after header
+    uint8_t flags;
+    uint16_t rate;      // Sample rate in Hz
+    uint16_t frame;     // Audio samples per mech byte
+};
+
+#endif	/* ULV_H */
+
@@ -0,0 +1,6 @@
+#ifndef HOST_AVR_CPUFUNC_H
+#define	HOST_AVR_CPUFUNC_H
+
+#define _NOP()
+
+#endif	/* HOST_AVR_CPUFUNC_H */
@@ -0,0 +1,12 @@
+#ifndef HOST_AVR_EEPROM_H
+#define	HOST_AVR_EEPROM_H
+
+#include <stddef.h>
+
+// EEPROM variables live in RAM, writes take the EEPROM write time of host.c
+#define EEMEM
+
+void eeprom_read_block(void *destination, const void *source, size_t size);
+void eeprom_update_block(const void *source, void *destination, size_t size);
+
+#endif	/* HOST_AVR_EEPROM_H */
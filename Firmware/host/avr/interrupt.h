@@ -0,0 +1,13 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define	HOST_AVR_INTERRUPT_H
+
+#include <stdint.h>
+
+// Global interrupt enable, interrupts are taken at register accesses and sleep in host.c
+extern volatile uint8_t host_interrupts;
+
+#define ISR(vector) void vector(void)
+#define sei() (host_interrupts = 1)
+#define cli() (host_interrupts = 0)
+
+#endif	/* HOST_AVR_INTERRUPT_H */
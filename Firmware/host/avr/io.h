@@ -0,0 +1,105 @@
+#ifndef HOST_AVR_IO_H
+#define	HOST_AVR_IO_H
+
+#include <stdint.h>
+
+// ATtiny1614 registers used by the firmware, for the host build. Every use of a peripheral goes through
+// host_access() in host.c, which applies the previous writes and advances the CPU clock. Registers that act on
+// a write are 16 bits wide and read with HOST_WRITTEN set, so that a write of any value can be told apart.
+
+#define HOST_WRITTEN 0x100
+
+typedef volatile uint8_t register8_t;
+typedef volatile uint16_t register16_t;
+
+typedef struct {
+    register8_t DIR, DIRSET, DIRCLR, DIRTGL;
+    register8_t OUT, OUTSET, OUTCLR, OUTTGL;
+    register8_t IN;
+    register16_t INTFLAGS;
+    register8_t PORTCTRL;
+    register8_t PIN0CTRL, PIN1CTRL, PIN2CTRL, PIN3CTRL, PIN4CTRL, PIN5CTRL, PIN6CTRL, PIN7CTRL;
+} PORT_t;
+
+typedef struct {
+    register8_t CTRLA;
+    register16_t DATA;
+} DAC_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB;
+} VREF_t;
+
+typedef struct {
+    register8_t CTRLA, STATUS, LVL0PRI, LVL1VEC;
+} CPUINT_t;
+
+typedef struct {
+    register8_t MCLKCTRLA, MCLKCTRLB, MCLKLOCK, MCLKSTATUS;
+} CLKCTRL_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB, CTRLC, CTRLD, CTRLECLR, CTRLESET, INTCTRL, INTFLAGS;
+    register8_t LCNT, HCNT, LPER, HPER, LCMP0, HCMP0, LCMP1, HCMP1, LCMP2, HCMP2;
+} TCA_SPLIT_t;
+
+typedef union {
+    TCA_SPLIT_t SPLIT;
+} TCA_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB, EVCTRL, INTCTRL;
+    register16_t INTFLAGS;
+    register8_t STATUS;
+    register16_t CNT, CCMP;
+} TCB_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB, INTCTRL;
+    register16_t INTFLAGS, DATA;
+} SPI_t;
+
+typedef struct {
+    register8_t CTRLA;
+} SLPCTRL_t;
+
+// Peripherals in the order host_access() tells them apart
+#define HOST_PORTA 0
+#define HOST_PORTB 1
+#define HOST_DAC0 2
+#define HOST_TCA0 3
+#define HOST_TCB0 4
+#define HOST_TCB1 5
+#define HOST_SPI0 6
+#define HOST_OTHER 7
+
+extern PORT_t host_porta, host_portb;
+extern DAC_t host_dac0;
+extern VREF_t host_vref;
+extern CPUINT_t host_cpuint;
+extern CLKCTRL_t host_clkctrl;
+extern TCA_t host_tca0;
+extern TCB_t host_tcb0, host_tcb1;
+extern SPI_t host_spi0;
+extern SLPCTRL_t host_slpctrl;
+
+void host_access(uint8_t peripheral);
+
+#define HOST_REGISTERS(peripheral, registers) (*(host_access(peripheral), &(registers)))
+
+#define PORTA HOST_REGISTERS(HOST_PORTA, host_porta)
+#define PORTB HOST_REGISTERS(HOST_PORTB, host_portb)
+#define DAC0 HOST_REGISTERS(HOST_DAC0, host_dac0)
+#define VREF HOST_REGISTERS(HOST_OTHER, host_vref)
+#define CPUINT HOST_REGISTERS(HOST_OTHER, host_cpuint)
+#define CLKCTRL HOST_REGISTERS(HOST_OTHER, host_clkctrl)
+#define TCA0 HOST_REGISTERS(HOST_TCA0, host_tca0)
+#define TCB0 HOST_REGISTERS(HOST_TCB0, host_tcb0)
+#define TCB1 HOST_REGISTERS(HOST_TCB1, host_tcb1)
+#define SPI0 HOST_REGISTERS(HOST_SPI0, host_spi0)
+#define SLPCTRL HOST_REGISTERS(HOST_OTHER, host_slpctrl)
+
+// Configuration change protection takes effect at once
+#define _PROTECTED_WRITE(reg, value) ((reg) = (value))
+
+#endif	/* HOST_AVR_IO_H */
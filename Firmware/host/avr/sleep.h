@@ -0,0 +1,9 @@
+#ifndef HOST_AVR_SLEEP_H
+#define	HOST_AVR_SLEEP_H
+
+void host_sleep(void);
+
+#define sleep_cpu() host_sleep()
+#define sleep_mode() host_sleep()
+
+#endif	/* HOST_AVR_SLEEP_H */
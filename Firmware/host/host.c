@@ -0,0 +1,475 @@
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#include "host.h"
+
+// Host build of the ATtiny1614 peripherals used by the firmware: ports, DAC, Timer A split mode outputs,
+// Timer B periodic interrupts and the SPI master, timed by a count of CPU clocks
+
+PORT_t host_porta, host_portb;
+DAC_t host_dac0;
+VREF_t host_vref;
+CPUINT_t host_cpuint;
+CLKCTRL_t host_clkctrl;
+TCA_t host_tca0;
+TCB_t host_tcb0, host_tcb1;
+SPI_t host_spi0;
+SLPCTRL_t host_slpctrl;
+volatile uint8_t host_interrupts = 0;
+
+uint64_t host_clock = 0;
+uint64_t host_limit = UINT64_MAX;
+struct host_costs host_costs = {2, 20, 10, 36000};
+struct host_device host_devices[2];
+struct host_log host_dac = {.width = 1};
+struct host_log host_actuators = {.width = 4};
+uint32_t host_conflicts = 0;
+
+void TCB0_INT_vect(void);
+void TCB1_INT_vect(void);
+
+// Timer B counting timer clocks from base, with the registers of the last access to tell writes apart
+struct timer {
+    TCB_t *registers;
+    void (*vector)(void);
+    uint8_t flags;
+    uint8_t running;
+    uint64_t base;
+    uint8_t ctrla, ctrlb, intctrl;
+    uint16_t ccmp;
+};
+
+static struct timer timers[2] = {
+    {.registers = &host_tcb0, .vector = TCB0_INT_vect},
+    {.registers = &host_tcb1, .vector = TCB1_INT_vect},
+};
+static uint64_t next_wrap = UINT64_MAX; // CPU clock of next timer wrap
+
+static jmp_buf stop;
+static uint8_t running = 0;             // Inside host_run
+static uint8_t previous = HOST_OTHER;   // Peripheral of last access, its writes are applied at the next one
+static uint8_t polls = 0;               // Unchanged accesses to a timer without interrupt
+static uint8_t selected = 0;            // Chip selects seen by the devices
+static uint8_t actuators[4];
+
+static void host_stop(int16_t reason) {
+    if (running) {
+        longjmp(stop, -reason);
+    }
+}
+
+static void log_append(struct host_log *log, const uint8_t *values) {
+    if (log->count == log->capacity) {
+        log->capacity = log->capacity ? log->capacity * 2 : 4096;
+        log->clocks = realloc(log->clocks, log->capacity * sizeof(*log->clocks));
+        log->values = realloc(log->values, (size_t) log->capacity * log->width);
+        if (!log->clocks || !log->values) {
+            abort();
+        }
+    }
+    log->clocks[log->count] = host_clock;
+    memcpy(log->values + (size_t) log->count * log->width, values, log->width);
+    log->count++;
+}
+
+void host_log_clear(struct host_log *log) {
+    log->count = 0;
+}
+
+// Timer B
+
+static uint32_t timer_divider(const struct timer *timer) {
+    static const uint16_t prescalers[8] = {1, 2, 4, 8, 16, 64, 256, 1024};
+
+    uint8_t clock = (timer->registers->CTRLA >> 1) & 0x3;
+    if (clock < 2) {
+        return clock + 1;
+    }
+    return prescalers[(host_tca0.SPLIT.CTRLA >> 1) & 0x7]; // Timer A clock
+}
+
+static uint64_t timer_next(const struct timer *timer) {
+    if (!timer->running) {
+        return UINT64_MAX;
+    }
+    return (timer->base + timer->registers->CCMP + 1) * timer_divider(timer);
+}
+
+// Count up to the CPU clock, setting the flag at every wrap past CCMP, and return 1 if registers were written
+
+static uint8_t timer_update(struct timer *timer) {
+    TCB_t *tcb = timer->registers;
+    uint8_t written = !(tcb->INTFLAGS & HOST_WRITTEN) || tcb->CTRLA != timer->ctrla || tcb->CTRLB != timer->ctrlb
+            || tcb->INTCTRL != timer->intctrl || tcb->CCMP != timer->ccmp;
+
+    if (!(tcb->INTFLAGS & HOST_WRITTEN)) {
+        timer->flags &= ~tcb->INTFLAGS; // Cleared by writing 1
+    }
+
+    if (!(tcb->CTRLA & 1)) {
+        timer->running = 0;
+    } else {
+        uint64_t now = host_clock / timer_divider(timer);
+        if (!timer->running) {
+            timer->base = now - tcb->CNT;
+            timer->running = 1;
+        }
+
+        uint32_t period = (uint32_t) tcb->CCMP + 1;
+        if (now - timer->base >= period) {
+            timer->base += (now - timer->base) / period * period;
+            timer->flags |= 1;
+        }
+        tcb->CNT = now - timer->base;
+    }
+
+    tcb->INTFLAGS = HOST_WRITTEN | timer->flags;
+    timer->ctrla = tcb->CTRLA;
+    timer->ctrlb = tcb->CTRLB;
+    timer->intctrl = tcb->INTCTRL;
+    timer->ccmp = tcb->CCMP;
+
+    return written;
+}
+
+static uint8_t timers_update(void) {
+    uint8_t written = 0;
+    next_wrap = UINT64_MAX;
+    for (uint8_t i = 0; i < 2; i++) {
+        written |= timer_update(&timers[i]);
+
+        uint64_t next = timer_next(&timers[i]);
+        if (next < next_wrap) {
+            next_wrap = next;
+        }
+    }
+
+    return written;
+}
+
+// CPU clock of next timer interrupt
+
+static uint64_t interrupt_next(void) {
+    uint64_t next = UINT64_MAX;
+    for (uint8_t i = 0; i < 2; i++) {
+        if ((timers[i].registers->INTCTRL & 1) && timer_next(&timers[i]) < next) {
+            next = timer_next(&timers[i]);
+        }
+    }
+
+    return next;
+}
+
+// Legs, mouth and left eye follow Timer A split mode compare outputs when routed to them, otherwise PORTB
+
+static void actuators_update(void) {
+    const register8_t *compare[3] = {&host_tca0.SPLIT.LCMP0, &host_tca0.SPLIT.LCMP1, &host_tca0.SPLIT.LCMP2};
+    uint8_t duties[4];
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if (i < 3 && (host_tca0.SPLIT.CTRLB & (1 << i))) {
+            duties[i] = *compare[i];
+        } else {
+            duties[i] = (host_portb.OUT & (1 << i)) ? 0xFF : 0;
+        }
+    }
+
+    if (memcmp(duties, actuators, sizeof(duties))) {
+        memcpy(actuators, duties, sizeof(duties));
+        log_append(&host_actuators, duties);
+    }
+}
+
+// Apply set, clear and toggle registers
+
+static void port_update(PORT_t *port) {
+    port->DIR = ((port->DIR | port->DIRSET) & ~port->DIRCLR) ^ port->DIRTGL;
+    port->OUT = ((port->OUT | port->OUTSET) & ~port->OUTCLR) ^ port->OUTTGL;
+    port->DIRSET = port->DIRCLR = port->DIRTGL = 0;
+    port->OUTSET = port->OUTCLR = port->OUTTGL = 0;
+    port->INTFLAGS = HOST_WRITTEN; // No pin change interrupts
+}
+
+// Chip selects are active low outputs
+
+static void select_update(void) {
+    uint8_t pins = ((host_porta.DIR & ~host_porta.OUT) >> 4) & 0x3;
+    uint8_t changed = pins ^ selected;
+    selected = pins;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        if ((changed & (1 << i)) && host_devices[i].select) {
+            host_devices[i].select(host_clock, (pins >> i) & 1);
+        }
+    }
+}
+
+// Clock a byte to the selected devices, SPI clock is the CPU clock divided by prescaler and CLK2X
+
+static uint8_t spi_exchange(uint8_t value) {
+    static const uint8_t dividers[4] = {4, 16, 64, 128};
+
+    if (!(host_spi0.CTRLA & 1)) {
+        return 0xFF;
+    }
+    uint16_t divider = dividers[(host_spi0.CTRLA >> 1) & 0x3] >> ((host_spi0.CTRLA >> 4) & 1);
+    uint64_t clock = host_clock;
+    host_clock += 8 * divider;
+
+    uint8_t received = 0xFF;
+    uint8_t devices = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        if ((selected & (1 << i)) && host_devices[i].transfer) {
+            received &= host_devices[i].transfer(clock, value);
+            devices++;
+        }
+    }
+    if (devices > 1) {
+        host_conflicts++;
+    }
+
+    return received;
+}
+
+// Apply writes of an access to a peripheral, returning 1 if any were seen
+
+static uint8_t apply(uint8_t peripheral) {
+    switch (peripheral) {
+        case HOST_PORTA:
+            port_update(&host_porta);
+            host_porta.IN = 1 << 7; // Mode button is released
+            select_update();
+            return 0;
+        case HOST_PORTB:
+            port_update(&host_portb);
+            actuators_update();
+            return 0;
+        case HOST_DAC0:
+            if (!(host_dac0.DATA & HOST_WRITTEN)) {
+                uint8_t value = host_dac0.DATA;
+                log_append(&host_dac, &value);
+                host_dac0.DATA = HOST_WRITTEN | value;
+                return 1;
+            }
+            return 0;
+        case HOST_TCA0:
+            actuators_update();
+            return 0;
+        case HOST_TCB0:
+        case HOST_TCB1:
+            return timers_update();
+        case HOST_SPI0:
+            host_spi0.INTFLAGS = HOST_WRITTEN | (1 << 6) | (1 << 5); // Transfer complete, buffer empty
+            if (!(host_spi0.DATA & HOST_WRITTEN)) {
+                host_spi0.DATA = HOST_WRITTEN | spi_exchange(host_spi0.DATA);
+                return 1;
+            }
+            return 0;
+    }
+
+    return 0;
+}
+
+// Run interrupts while enabled, returning the number taken
+
+static uint8_t interrupts(void) {
+    uint8_t taken = 0;
+
+    while (host_interrupts) {
+        struct timer *timer = NULL;
+        for (uint8_t i = 0; i < 2 && !timer; i++) {
+            if ((timers[i].flags & 1) && (timers[i].registers->INTCTRL & 1)) {
+                timer = &timers[i];
+            }
+        }
+        if (!timer) {
+            break;
+        }
+
+        cli();
+        host_clock += host_costs.interrupt;
+        timer->vector();
+        apply(previous);
+        previous = HOST_OTHER;
+        sei();
+        taken++;
+    }
+
+    return taken;
+}
+
+// Called at every use of a peripheral, before it is read or written
+
+void host_access(uint8_t peripheral) {
+    host_clock += host_costs.access;
+    if (host_clock > host_limit) {
+        host_stop(HOST_TIMEOUT);
+    }
+
+    uint8_t written = apply(previous);
+
+    if (peripheral == HOST_TCB0 || peripheral == HOST_TCB1) {
+        // Reading a timer without interrupt without changes polls its flag, skip to the wrap
+        struct timer *timer = &timers[peripheral - HOST_TCB0];
+        written |= timers_update();
+        if (peripheral == previous && !written && timer->running && !(timer->registers->INTCTRL & 1)
+                && !(timer->flags & 1)) {
+            polls++;
+        } else {
+            polls = 0;
+        }
+
+        if (polls >= 2) {
+            uint64_t clock = timer_next(timer);
+            if (host_interrupts && interrupt_next() < clock) {
+                clock = interrupt_next();
+            }
+            if (clock > host_limit) {
+                host_stop(HOST_TIMEOUT);
+            }
+            if (clock > host_clock) {
+                host_clock = clock;
+            }
+            polls = 0;
+        }
+    } else {
+        polls = 0;
+    }
+
+    if (host_clock >= next_wrap) {
+        timers_update();
+    }
+
+    previous = HOST_OTHER;
+    interrupts();
+    previous = peripheral;
+}
+
+// Apply outstanding writes and take pending interrupts
+
+void host_sync(void) {
+    apply(previous);
+    previous = HOST_OTHER;
+    timers_update();
+    interrupts();
+}
+
+// Sleep until the next interrupt, stopping when none can wake up the CPU
+
+void host_sleep(void) {
+    apply(previous);
+    previous = HOST_OTHER;
+    timers_update();
+    if (interrupts()) {
+        return; // Interrupt was pending
+    }
+
+    uint64_t clock = host_interrupts ? interrupt_next() : UINT64_MAX;
+    if (clock == UINT64_MAX) {
+        host_stop(HOST_ASLEEP);
+        return;
+    }
+    if (clock > host_limit) {
+        host_stop(HOST_TIMEOUT);
+    }
+
+    if (clock > host_clock) {
+        host_clock = clock;
+    }
+    host_clock += host_costs.wake;
+    timers_update();
+    interrupts();
+}
+
+// EEPROM variables are in RAM
+
+void eeprom_read_block(void *destination, const void *source, size_t size) {
+    memcpy(destination, source, size);
+}
+
+void eeprom_update_block(const void *source, void *destination, size_t size) {
+    const uint8_t *from = source;
+    uint8_t *to = destination;
+
+    for (size_t i = 0; i < size; i++) {
+        if (to[i] != from[i]) {
+            to[i] = from[i];
+            host_clock += host_costs.eeprom;
+        }
+    }
+}
+
+// Reset peripherals and CPU clock, flash memory keeps its contents
+
+void host_reset(void) {
+    memset((void *) &host_porta, 0, sizeof(host_porta));
+    memset((void *) &host_portb, 0, sizeof(host_portb));
+    memset((void *) &host_dac0, 0, sizeof(host_dac0));
+    memset((void *) &host_vref, 0, sizeof(host_vref));
+    memset((void *) &host_cpuint, 0, sizeof(host_cpuint));
+    memset((void *) &host_clkctrl, 0, sizeof(host_clkctrl));
+    memset((void *) &host_tca0, 0, sizeof(host_tca0));
+    memset((void *) &host_tcb0, 0, sizeof(host_tcb0));
+    memset((void *) &host_tcb1, 0, sizeof(host_tcb1));
+    memset((void *) &host_spi0, 0, sizeof(host_spi0));
+    memset((void *) &host_slpctrl, 0, sizeof(host_slpctrl));
+
+    host_porta.IN = 1 << 7;
+    host_porta.INTFLAGS = HOST_WRITTEN;
+    host_portb.INTFLAGS = HOST_WRITTEN;
+    host_dac0.DATA = HOST_WRITTEN;
+    host_spi0.DATA = HOST_WRITTEN | 0xFF;
+    host_spi0.INTFLAGS = HOST_WRITTEN | (1 << 6) | (1 << 5);
+    host_clkctrl.MCLKSTATUS = 1 << 4; // Oscillator is stable
+
+    for (uint8_t i = 0; i < 2; i++) {
+        timers[i].registers->INTFLAGS = HOST_WRITTEN;
+        timers[i].flags = 0;
+        timers[i].running = 0;
+        timers[i].ctrla = timers[i].ctrlb = timers[i].intctrl = 0;
+        timers[i].ccmp = 0;
+    }
+    next_wrap = UINT64_MAX;
+
+    host_interrupts = 0;
+    host_clock = 0;
+    host_conflicts = 0;
+    previous = HOST_OTHER;
+    polls = 0;
+    selected = 0;
+    memset(actuators, 0, sizeof(actuators));
+    host_log_clear(&host_dac);
+    host_log_clear(&host_actuators);
+
+    host_devices[HOST_FLASH] = host_memory_device;
+    host_devices[HOST_SD] = (struct host_device) {NULL, NULL};
+}
+
+// Run a firmware function until it returns or the CPU stops
+
+static int16_t run(uint8_t (*function)(void), uint8_t (*function_argument)(uint8_t), uint8_t argument) {
+    int reason = setjmp(stop);
+    if (reason) {
+        running = 0;
+        return -reason;
+    }
+
+    running = 1;
+    uint8_t result = function ? function() : function_argument(argument);
+    host_sync();
+    running = 0;
+
+    return result;
+}
+
+int16_t host_run(uint8_t (*function)(void)) {
+    return run(function, NULL, 0);
+}
+
+int16_t host_call(uint8_t (*function)(uint8_t), uint8_t argument) {
+    return run(NULL, function, argument);
+}
@@ -0,0 +1,59 @@
+#ifndef HOST_H
+#define	HOST_H
+
+#include <stdint.h>
+
+// SPI devices by chip select pin, PA4 and PA5
+#define HOST_FLASH 0
+#define HOST_SD 1
+
+// Results of host_run besides the return value of the function
+#define HOST_ASLEEP -1  // Slept without an interrupt to wake up, e.g. powered down
+#define HOST_TIMEOUT -2 // CPU clock passed host_limit
+
+#define HOST_MEMORY_SIZE 0x1000000UL // W25Q128, 16 MB
+
+// SPI device, called with the CPU clock at chip select changes and for bytes clocked while selected
+struct host_device {
+    void (*select)(uint64_t clock, uint8_t selected);
+    uint8_t (*transfer)(uint64_t clock, uint8_t value);
+};
+
+// Estimated CPU clocks, only register accesses, SPI bytes, interrupts and EEPROM writes take time
+struct host_costs {
+    uint32_t access;    // I/O register access, standing for the code around it
+    uint32_t interrupt; // Interrupt entry and return
+    uint32_t wake;      // Wake-up from sleep
+    uint32_t eeprom;    // EEPROM erase and write of a changed byte
+};
+
+// Output changes with the CPU clock, width bytes each
+struct host_log {
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t width;
+    uint64_t *clocks;
+    uint8_t *values;
+};
+
+extern uint64_t host_clock;
+extern uint64_t host_limit;
+extern struct host_costs host_costs;
+extern struct host_device host_devices[2];
+extern struct host_log host_dac;        // DAC writes
+extern struct host_log host_actuators;  // Leg, mouth, left and right eye duty 0-255 at every change
+extern uint32_t host_conflicts;         // Bytes clocked with both devices selected
+
+void host_reset(void);
+int16_t host_run(uint8_t (*function)(void));
+int16_t host_call(uint8_t (*function)(uint8_t), uint8_t argument);
+void host_sync(void);
+void host_log_clear(struct host_log *log);
+
+// Flash memory without busy times in memory.c, the flash device after host_reset
+extern uint8_t host_memory[HOST_MEMORY_SIZE];
+extern const struct host_device host_memory_device;
+
+void host_memory_erase(void);
+
+#endif	/* HOST_H */
@@ -0,0 +1,113 @@
+#include <string.h>
+
+#include "host.h"
+
+// W25Q128 commands used by flash.c and main.c on a RAM array, programs and erases finish at once
+
+uint8_t host_memory[HOST_MEMORY_SIZE];
+
+static uint8_t command;
+static uint8_t address_bytes = 3;   // 4 after 0xB7
+static uint32_t address;
+static uint32_t position;           // Bytes since select
+static uint8_t write_enable;
+
+void host_memory_erase(void) {
+    memset(host_memory, 0xFF, sizeof(host_memory));
+}
+
+static void erase(uint32_t size) {
+    memset(host_memory + (address & (HOST_MEMORY_SIZE - 1) & ~(size - 1)), 0xFF, size);
+}
+
+static void memory_select(uint64_t clock, uint8_t selected) {
+    (void) clock; // Programs and erases take no time
+
+    if (selected) {
+        position = 0;
+        return;
+    }
+
+    // Erases and address mode take effect at deselect
+    if (position == 0) {
+        return;
+    }
+    uint8_t addressed = position > address_bytes;
+    switch (command) {
+        case 0x06:
+            write_enable = 1;
+            break;
+        case 0x04:
+            write_enable = 0;
+            break;
+        case 0x02:
+            if (addressed) {
+                write_enable = 0;
+            }
+            break;
+        case 0x20:
+        case 0x52:
+        case 0xD8:
+            if (write_enable && addressed) {
+                erase(command == 0x20 ? 0x1000 : command == 0x52 ? 0x8000 : 0x10000);
+            }
+            write_enable = 0;
+            break;
+        case 0xC7:
+        case 0x60:
+            if (write_enable) {
+                host_memory_erase();
+            }
+            write_enable = 0;
+            break;
+        case 0xB7:
+            address_bytes = 4;
+            break;
+        case 0xE9:
+            address_bytes = 3;
+            break;
+    }
+}
+
+static uint8_t memory_transfer(uint64_t clock, uint8_t value) {
+    (void) clock;
+    uint32_t index = position++;
+
+    if (index == 0) {
+        command = value;
+        address = 0;
+        return 0xFF;
+    }
+
+    switch (command) {
+        case 0x05:
+            return write_enable << 1; // Never busy
+        case 0x35:
+            return 0; // No suspended erase
+        case 0x9F:
+            return index == 1 ? 0xEF : index == 2 ? 0x40 : index == 3 ? 0x18 : 0xFF;
+        case 0x03:
+        case 0x02:
+        case 0x20:
+        case 0x52:
+        case 0xD8:
+            if (index <= address_bytes) {
+                address = (address << 8) | value;
+                return 0xFF;
+            }
+            address &= HOST_MEMORY_SIZE - 1;
+            if (command == 0x03) {
+                return host_memory[(address + index - address_bytes - 1) & (HOST_MEMORY_SIZE - 1)];
+            }
+            if (command == 0x02 && write_enable) {
+                // Page program wraps within the page
+                uint32_t offset = (address + index - address_bytes - 1) & 0xFF;
+                host_memory[(address & ~0xFFUL) | offset] &= value;
+            }
+            return 0xFF;
+    }
+
+    return 0xFF; // No SFDP and other commands are ignored
+}
+
+const struct host_device host_memory_device = {memory_select, memory_transfer};
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pff.h"
+#include "host.h"
+#include "sdcard.h"
+
+// SDHC card in SPI mode over a card image file, answering the commands of diskio.c at once and counting
+// the traffic of the real driver
+
+extern FATFS file_system; // main.c, tells FAT and data sectors apart once mounted
+
+static FILE *image_file;
+static uint16_t access_bytes;           // Clocks until the data token of a read, card dependent
+static struct sdcard_counters ignored;
+static struct sdcard_counters *counters = &ignored;
+
+static uint8_t idle;                    // Idle state until ACMD41
+static uint8_t application;             // Last command was CMD55
+static uint8_t packet[6];
+static uint8_t received;                // Command packet bytes
+static uint8_t response[8];
+static uint8_t response_length;
+static uint8_t response_position;
+static uint8_t block[512];
+static uint16_t block_position;         // Bytes of data packet sent, reading when below its length
+static uint16_t block_length;
+
+static void respond(uint8_t r1, const uint8_t *data, uint8_t count) {
+    response[0] = r1;
+    memcpy(response + 1, data, count);
+    response_length = count + 1;
+    response_position = 0;
+}
+
+// CMD17, data packet of access bytes, data token, sector and CRC follows R1
+
+static void read_block(uint32_t sector) {
+    if (!image_file || fseek(image_file, (long) sector * 512, SEEK_SET) || fread(block, 1, 512, image_file) != 512) {
+        respond(0x40, NULL, 0); // Parameter error
+        return;
+    }
+    respond(0x00, NULL, 0);
+    block_position = 0;
+    block_length = access_bytes + 1 + 512 + 2;
+
+    counters->cmd17++;
+    if (!file_system.fs_type || sector < file_system.fatbase) {
+        counters->boot_reads++;
+    } else if (sector < file_system.database) {
+        counters->fat_reads++;
+    } else {
+        counters->data_reads++;
+    }
+}
+
+static void command(void) {
+    static const uint8_t ocr[4] = {0xC0, 0xFF, 0x80, 0x00}; // Powered up, high capacity
+    uint8_t index = packet[0] & 0x3F;
+    uint32_t argument = (uint32_t) packet[1] << 24 | (uint32_t) packet[2] << 16 | packet[3] << 8 | packet[4];
+    uint8_t application_command = application;
+
+    counters->commands++;
+    application = 0;
+    switch (index) {
+        case 0:
+            idle = 1;
+            respond(0x01, NULL, 0);
+            break;
+        case 8: {
+            uint8_t condition[4] = {0x00, 0x00, (argument >> 8) & 0x0F, argument & 0xFF};
+            respond(idle, condition, sizeof(condition));
+            break;
+        }
+        case 55:
+            application = 1;
+            respond(idle, NULL, 0);
+            break;
+        case 41:
+            if (application_command) {
+                idle = 0;
+                respond(0x00, NULL, 0);
+            } else {
+                respond(idle | 0x04, NULL, 0);
+            }
+            break;
+        case 58:
+            respond(idle, ocr, sizeof(ocr));
+            break;
+        case 16:
+            respond(idle, NULL, 0);
+            break;
+        case 17:
+            read_block(argument);
+            break;
+        default:
+            respond(idle | 0x04, NULL, 0); // Illegal command
+    }
+}
+
+static void sdcard_select(uint64_t clock, uint8_t selected) {
+    static uint64_t selected_clock;
+    if (selected) {
+        selected_clock = clock;
+    } else {
+        counters->clocks += clock - selected_clock;
+    }
+
+    received = 0;
+    response_length = 0;
+    block_length = 0;
+}
+
+static uint8_t sdcard_transfer(uint64_t clock, uint8_t value) {
+    uint8_t out = 0xFF;
+    if (!counters->bytes) {
+        counters->start = clock;
+    }
+    counters->bytes++;
+    counters->end = clock;
+
+    // Response, then data packet of a read
+    if (response_position < response_length) {
+        out = response[response_position++];
+    } else if (block_position < block_length) {
+        uint16_t position = block_position++;
+        if (position == access_bytes) {
+            out = 0xFE;
+        } else if (position > access_bytes && position <= access_bytes + 512) {
+            out = block[position - access_bytes - 1];
+        }
+    }
+
+    // Command packets start with bits 01
+    if (received || (value & 0xC0) == 0x40) {
+        packet[received++] = value;
+        if (received == sizeof(packet)) {
+            received = 0;
+            command();
+        }
+    }
+
+    return out;
+}
+
+// Attach the card to the SD card chip select, after host_reset
+
+int sdcard_open(const char *image, uint16_t access) {
+    sdcard_close();
+    image_file = fopen(image, "rb");
+    access_bytes = access;
+    idle = 1;
+    application = 0;
+    received = 0;
+    response_length = 0;
+    block_length = 0;
+
+    host_devices[HOST_SD] = (struct host_device) {sdcard_select, sdcard_transfer};
+
+    return image_file == NULL;
+}
+
+void sdcard_close(void) {
+    if (image_file) {
+        fclose(image_file);
+        image_file = NULL;
+    }
+}
+
+// Count following traffic into counters, NULL to stop counting
+
+void sdcard_count(struct sdcard_counters *into) {
+    counters = into ? into : &ignored;
+}
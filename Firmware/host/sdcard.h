@@ -0,0 +1,23 @@
+#ifndef SDCARD_H
+#define	SDCARD_H
+
+#include <stdint.h>
+
+// SD card traffic of a load phase as clocked by diskio.c, the bytes of its trace records
+struct sdcard_counters {
+    uint32_t commands;      // Commands of any kind
+    uint32_t cmd17;         // READ_SINGLE_BLOCK commands
+    uint32_t boot_reads;    // Reads of MBR and boot sectors
+    uint32_t fat_reads;     // Reads of FAT sectors
+    uint32_t data_reads;    // Reads of directory and file clusters
+    uint64_t bytes;         // Bytes clocked while selected
+    uint64_t start;         // CPU clocks at first and last byte
+    uint64_t end;
+    uint64_t clocks;        // CPU clocks while selected
+};
+
+int sdcard_open(const char *image, uint16_t access);
+void sdcard_close(void);
+void sdcard_count(struct sdcard_counters *counters);
+
+#endif	/* SDCARD_H */
@@ -0,0 +1,18 @@
+#ifndef HOST_UTIL_ATOMIC_H
+#define	HOST_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+#define ATOMIC_RESTORESTATE 0
+
+static inline uint8_t host_atomic_start(void) {
+    uint8_t state = host_interrupts;
+    cli();
+    return state;
+}
+
+// Block interrupts for the statement, restoring the global interrupt enable afterwards
+#define ATOMIC_BLOCK(type) for (uint8_t host_state = host_atomic_start(), host_once = 1; host_once; \
+        host_once = 0, host_interrupts = host_state)
+
+#endif	/* HOST_UTIL_ATOMIC_H */
@@ -11,6 +11,8 @@
 /*-------------------------------------------------------------------------*/
 
 #include <avr/io.h> /* Device specific include files */
+#include "timer.h"  /* Timer ticks for timeouts */
+#include "trace.h"  /* SPI transaction trace */
 
 #define SPIPORT PORTA
 #define SPI_SCK (1 << 3)  /* PA3 */
@@ -19,12 +21,21 @@
 #define SPI_CS (1 << 5)   /* PA5 */
 
 /* Port controls  (Platform dependent) */
-#define SELECT() SPIPORT.OUTCLR = SPI_CS   /* CS = L */
-#define DESELECT() SPIPORT.OUTSET = SPI_CS /* CS = H */
+#define SELECT() do { SPIPORT.OUTCLR = SPI_CS; trace_select(TRACE_SD); } while (0)     /* CS = L */
+#define DESELECT() do { SPIPORT.OUTSET = SPI_CS; trace_deselect(TRACE_SD); } while (0) /* CS = H */
 #define SELECTING ((SPIPORT.DIR & SPI_CS) && !(SPIPORT.OUT & SPI_CS))
 
+/* Timeouts in ms and retries (Platform dependent) */
+#define TMO_NODISK 10   /* No response to GO_IDLE_STATE, card is absent */
+#define TMO_IDLE 100    /* GO_IDLE_STATE */
+#define TMO_INIT 1000   /* Leaving idle state */
+#define TMO_READ 100    /* Data token of a read */
+#define READ_RETRIES 3  /* Attempts per sector read */
+
 static BYTE spi(BYTE d)
 {
+    trace_byte(d);
+
     while (!(SPI0.INTFLAGS & (1 << 5))); // Wait for empty data buffer
     SPI0.DATA = d;
     while (!(SPI0.INTFLAGS & (1 << 6))); // Wait for transmit
@@ -149,8 +160,9 @@ static BYTE send_cmd(BYTE  cmd, /* 1st byte (Start + Index) */
 
 DSTATUS disk_initialize(void)
 {
-	BYTE n, cmd, ty, ocr[4];
-	UINT tmr;
+	BYTE n, cmd, ty, res, ocr[4];
+	DWORD start;
+	BYTE seen;
 
 #if _USE_WRITE
 	if (CardType && SELECTING)
@@ -162,18 +174,33 @@ DSTATUS disk_initialize(void)
 		rcv_spi(); /* 80 dummy clocks with CS=H */
 
 	ty = 0;
-    
-    for (tmr = 100; tmr && send_cmd(CMD0, 0) != 1; tmr--);
-	if (tmr) {         /* GO_IDLE_STATE */
+
+	/* Pull MISO up so that an absent card reads as 0xFF */
+	SPIPORT.PIN2CTRL |= 1 << 3;
+
+	start = timer_ticks();
+	seen = 0;
+	do {   /* GO_IDLE_STATE */
+		res = send_cmd(CMD0, 0);
+		if (res != 0xFF)
+			seen = 1;
+		if (!seen && timer_ticks() - start >= TIMER_MS(TMO_NODISK))
+			break; /* Nothing is driving MISO */
+	} while (res != 1 && timer_ticks() - start < TIMER_MS(TMO_IDLE));
+
+	SPIPORT.PIN2CTRL &= ~(1 << 3);
+
+	if (res == 1) {
 		if (send_cmd(CMD8, 0x1AA) == 1) { /* SDv2 */
 			for (n = 0; n < 4; n++)
 				ocr[n] = rcv_spi();                 /* Get trailing return value of R7 resp */
 			if (ocr[2] == 0x01 && ocr[3] == 0xAA) { /* The card can work at vdd range of 2.7-3.6V */
-				for (tmr = 10000; tmr && send_cmd(ACMD41, 1UL << 30); tmr--);   /* Wait for leaving idle state (ACMD41 with HCS bit) */
-                if (tmr && !send_cmd(CMD58, 0)) {
-                    for (n = 0; n < 4; n++)
-                        ocr[n] = rcv_spi();
-                    ty = (ocr[0] & 0x40) ? CT_SD2 | CT_BLOCK : CT_SD2; /* SDv2 (HC or SC) */
+				start = timer_ticks();
+				while (send_cmd(ACMD41, 1UL << 30) && timer_ticks() - start < TIMER_MS(TMO_INIT));   /* Wait for leaving idle state (ACMD41 with HCS bit) */
+				if (timer_ticks() - start < TIMER_MS(TMO_INIT) && !send_cmd(CMD58, 0)) {
+					for (n = 0; n < 4; n++)
+						ocr[n] = rcv_spi();
+					ty = (ocr[0] & 0x40) ? CT_SD2 | CT_BLOCK : CT_SD2; /* SDv2 (HC or SC) */
 				}
 			}
 		} else { /* SDv1 or MMCv3 */
@@ -184,17 +211,18 @@ DSTATUS disk_initialize(void)
 				ty  = CT_MMC;
 				cmd = CMD1; /* MMCv3 */
 			}
-			for (tmr = 10000; tmr && send_cmd(cmd, 0); tmr--);  /* Wait for leaving idle state */
-			if (!tmr || send_cmd(CMD16, 512) != 0) /* Set R/W block length to 512 */
+			start = timer_ticks();
+			while (send_cmd(cmd, 0) && timer_ticks() - start < TIMER_MS(TMO_INIT));  /* Wait for leaving idle state */
+			if (timer_ticks() - start >= TIMER_MS(TMO_INIT) || send_cmd(CMD16, 512) != 0) /* Set R/W block length to 512 */
 				ty = 0;
 		}
 	}
-    else {
-        DESELECT();
-        rcv_spi();
-        return STA_NODISK;
-    }
-    
+	else {
+		DESELECT();
+		rcv_spi();
+		return STA_NODISK;
+	}
+
 	CardType = ty;
 	DESELECT();
 	rcv_spi();
@@ -213,50 +241,52 @@ DRESULT disk_readp(BYTE *buff,   /* Pointer to the read buffer (NULL:Forward to
 )
 {
 	DRESULT res;
-	BYTE    rc;
-	UINT    bc;
+	BYTE    rc, n;
+	UINT    bc, ofs;
+	DWORD   start;
 
 	if (!(CardType & CT_BLOCK))
 		sector *= 512; /* Convert to byte address if needed */
 
 	res = RES_ERROR;
-	if (send_cmd(CMD17, sector) == 0) { /* READ_SINGLE_BLOCK */
-
-		// bc = 40000;	/* Time counter */
-		do { /* Wait for response */
-			rc = rcv_spi();
-		} while (rc == 0xFF);
-
-		if (rc == 0xFE) { /* A data packet arrived */
-
-			bc = 512 + 2 - offset - count; /* Number of trailing bytes to skip */
-
-			/* Skip leading bytes */
-			while (offset--)
-				rcv_spi();
-
-			/* Receive a part of the sector */
-			if (buff) { /* Store data to the memory */
-				do {
-					*buff++ = rcv_spi();
-				} while (--count);
-			} else { /* Forward data to the outgoing stream */
-				do {
-					// FORWARD(rcv_spi());
-				} while (--count);
-			}
+	for (n = READ_RETRIES; n && res != RES_OK; n--) {
+		if (send_cmd(CMD17, sector) == 0) { /* READ_SINGLE_BLOCK */
+
+			start = timer_ticks();
+			do { /* Wait for response */
+				rc = rcv_spi();
+			} while (rc == 0xFF && timer_ticks() - start < TIMER_MS(TMO_READ));
+
+			if (rc == 0xFE) { /* A data packet arrived */
+
+				bc = 512 + 2 - offset - count; /* Number of trailing bytes to skip */
+
+				/* Skip leading bytes */
+				for (ofs = offset; ofs; ofs--)
+					rcv_spi();
+
+				/* Receive a part of the sector */
+				if (buff) { /* Store data to the memory */
+					for (ofs = 0; ofs < count; ofs++)
+						buff[ofs] = rcv_spi();
+				} else { /* Forward data to the outgoing stream */
+					for (ofs = 0; ofs < count; ofs++) {
+						// FORWARD(rcv_spi());
+					}
+				}
 
-			/* Skip trailing bytes and CRC */
-			do
-				rcv_spi();
-			while (--bc);
+				/* Skip trailing bytes and CRC */
+				do
+					rcv_spi();
+				while (--bc);
 
-			res = RES_OK;
+				res = RES_OK;
+			}
 		}
-	}
 
-	DESELECT();
-	rcv_spi();
+		DESELECT();
+		rcv_spi();
+	}
 
 	return res;
 }
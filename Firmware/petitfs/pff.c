@@ -833,7 +833,7 @@ FRESULT pf_mount(FATFS *fs /* Pointer to new file system object */
 			fmt = 3;
 		} else {
 			if (buf[4]) {                     /* Is the partition existing? */
-				bsect = ld_word(&buf[8]);    /* Partition offset in LBA */
+				bsect = ld_dword(&buf[8]);    /* Partition offset in LBA */
 				fmt   = check_fs(buf, bsect); /* Check the partition */
 			}
 		}
@@ -849,7 +849,7 @@ FRESULT pf_mount(FATFS *fs /* Pointer to new file system object */
 
 	fsize = ld_word(buf + BPB_FATSz16 - 13); /* Number of sectors per FAT */
 	if (!fsize)
-		fsize = ld_word(buf + BPB_FATSz32 - 13);
+		fsize = ld_dword(buf + BPB_FATSz32 - 13);
 
 	fsize *= buf[BPB_NumFATs - 13];                             /* Number of sectors in FAT area */
 	fs->fatbase   = bsect + ld_word(buf + BPB_RsvdSecCnt - 13); /* FAT start sector (lba) */
@@ -857,7 +857,7 @@ FRESULT pf_mount(FATFS *fs /* Pointer to new file system object */
 	fs->n_rootdir = ld_word(buf + BPB_RootEntCnt - 13);         /* Nmuber of root directory entries */
 	tsect         = ld_word(buf + BPB_TotSec16 - 13);           /* Number of sectors on the file system */
 	if (!tsect)
-		tsect = ld_word(buf + BPB_TotSec32 - 13);
+		tsect = ld_dword(buf + BPB_TotSec32 - 13);
 	mclst = (tsect /* Last cluster# + 1 */
 	         - ld_word(buf + BPB_RsvdSecCnt - 13) - fsize - fs->n_rootdir / 16)
 	            / fs->csize
@@ -876,7 +876,7 @@ FRESULT pf_mount(FATFS *fs /* Pointer to new file system object */
 	fs->fs_type = fmt;
 
 	if (_FS_32ONLY || (FS_FAT32 && fmt == FS_FAT32))
-		fs->dirbase = ld_word(buf + (BPB_RootClus - 13)); /* Root directory start cluster */
+		fs->dirbase = ld_dword(buf + (BPB_RootClus - 13)); /* Root directory start cluster */
 	else
 		fs->dirbase = fs->fatbase + fsize;                   /* Root directory start sector (lba) */
 	fs->database = fs->fatbase + fsize + fs->n_rootdir / 16; /* Data start sector (lba) */
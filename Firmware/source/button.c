@@ -0,0 +1,93 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "button.h"
+#include "gpio.h"
+#include "timer.h"
+
+#define BUTTON_PIN 7
+#define BUTTON_DEBOUNCE_MS 20
+#define BUTTON_HOLD_MS 500
+#define BUTTON_SELECT_MS 1500 // After hold
+
+volatile uint8_t button_state = BUTTON_IDLE;
+volatile uint8_t button_event = BUTTON_EVENT_NONE;
+volatile uint32_t button_edge = 0; // Timer ticks at last edge
+
+// Take pending button event
+
+uint8_t button_take(void) {
+    cli(); // Block interrupts
+    uint8_t event = button_event;
+    button_event = BUTTON_EVENT_NONE;
+    sei(); // Unblock interrupts
+
+    return event;
+}
+
+// Button held, indicate long and extra long press with eye LEDs
+
+static void button_held(void) {
+    if (button_state == BUTTON_PRESSED) {
+        button_state = BUTTON_HELD;
+
+        gpio_write(1, 0, 0);
+        gpio_write(1, 1, 0);
+        gpio_write(1, 2, 1);
+        gpio_write(1, 3, 1);
+
+        timer_start(TIMER_HOLD, TIMER_MS(BUTTON_SELECT_MS), 0, button_held);
+    } else if (button_state == BUTTON_HELD) {
+        button_state = BUTTON_SELECT;
+
+        gpio_write(1, 2, 0);
+        gpio_write(1, 3, 0);
+    }
+}
+
+// Debounce finished, classify press or release
+
+static void button_debounced(void) {
+    uint8_t pressed = !(PORTA.IN & (1 << BUTTON_PIN));
+
+    if (pressed && button_state == BUTTON_IDLE) {
+        button_state = BUTTON_PRESSED;
+
+        // Wait for hold time from press edge
+        uint32_t held = timer_ticks() - button_edge;
+        uint32_t hold = TIMER_MS(BUTTON_HOLD_MS);
+        timer_start(TIMER_HOLD, held < hold ? hold - held : 0, 0, button_held);
+    } else if (!pressed && button_state != BUTTON_IDLE) {
+        timer_stop(TIMER_HOLD);
+
+        if (button_state == BUTTON_PRESSED) {
+            button_event = BUTTON_EVENT_SHORT;
+        } else if (button_state == BUTTON_HELD) {
+            button_event = BUTTON_EVENT_LONG;
+        } else {
+            button_event = BUTTON_EVENT_EXTRA_LONG;
+        }
+
+        gpio_write(1, 2, 0);
+        gpio_write(1, 3, 0);
+
+        button_state = BUTTON_IDLE;
+    }
+}
+
+// Configure mode button pin
+
+void button_init(void) {
+    PORTA.PIN7CTRL = (1 << 3) | 0x1; // Enable mode switch pull-up resistor and both-edge interrupt
+}
+
+// Mode button interrupt, timestamp edge and start debounce
+
+ISR(PORTA_PORT_vect) {
+    PORTA.INTFLAGS = 1 << BUTTON_PIN;
+
+    button_edge = timer_ticks();
+
+    // Sample pin when it has been stable for debounce time
+    timer_start(TIMER_DEBOUNCE, TIMER_MS(BUTTON_DEBOUNCE_MS), 0, button_debounced);
+}
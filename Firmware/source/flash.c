@@ -4,6 +4,98 @@
 #include "flash.h"
 #include "spi.h"
 
+uint32_t flash_size = FLASH_SIZE;
+uint16_t flash_page = 256;
+uint8_t flash_erase_cmd = 0xD8; // 64 kB block erase
+static uint8_t flash_address_bytes = 3;
+static uint8_t flash_erasing = 0; // 1 when erasing, 2 when erase is suspended
+
+// Read serial flash discoverable parameters
+static void flash_read_sfdp(uint32_t address, uint8_t *buff, uint8_t count) {
+    spi_peripheral(0, 1);
+    spi_transfer(0x5A);
+    spi_transfer((address >> 16) & 0xFF);
+    spi_transfer((address >> 8) & 0xFF);
+    spi_transfer(address & 0xFF);
+    spi_transfer(0xFF); // Dummy byte
+
+    while (count--) {
+        *buff++ = spi_transfer(0xFF);
+    }
+    spi_peripheral(0, 0);
+}
+
+// Probe capacity, page size and block erase of external flash, defaults are for W25Q128
+uint8_t flash_init(void) {
+    flash_wait();
+
+    // Read JEDEC ID
+    spi_peripheral(0, 1);
+    spi_transfer(0x9F);
+    uint8_t manufacturer = spi_transfer(0xFF);
+    spi_transfer(0xFF); // Memory type
+    uint8_t capacity = spi_transfer(0xFF);
+    spi_peripheral(0, 0);
+
+    if (manufacturer == 0x00 || manufacturer == 0xFF) {
+        return 1;
+    }
+    if (capacity >= 0x10 && capacity < 0x20) {
+        flash_size = 1UL << capacity;
+    }
+
+    uint8_t sfdp[44];
+    flash_read_sfdp(0, sfdp, 16);
+    if (sfdp[0] == 'S' && sfdp[1] == 'F' && sfdp[2] == 'D' && sfdp[3] == 'P') {
+        // Basic flash parameter table from first parameter header
+        uint32_t table = sfdp[12] | ((uint32_t) sfdp[13] << 8) | ((uint32_t) sfdp[14] << 16);
+        uint8_t dwords = sfdp[11] < 11 ? sfdp[11] : 11;
+        flash_read_sfdp(table, sfdp, dwords * 4);
+
+        // Density in bits
+        uint32_t density = sfdp[4] | ((uint32_t) sfdp[5] << 8) | ((uint32_t) sfdp[6] << 16) | ((uint32_t) sfdp[7] << 24);
+        if (!(density & (1UL << 31))) {
+            flash_size = (density >> 3) + 1;
+        } else if ((density & 0x7FFFFFFF) > 3 && (density & 0x7FFFFFFF) < 35) {
+            flash_size = 1UL << ((density & 0x7FFFFFFF) - 3);
+        }
+
+        // Erase type sizes and commands
+        for (uint8_t i = 28; i < 36 && i < dwords * 4; i += 2) {
+            if (sfdp[i] == 16) {
+                flash_erase_cmd = sfdp[i + 1];
+            }
+        }
+
+        // Page size
+        if (dwords >= 11) {
+            flash_page = 1 << (sfdp[40] >> 4);
+        }
+    }
+
+    // Enter 4-byte address mode for flash larger than 16 MB
+    if (flash_size > 0x1000000UL) {
+        spi_peripheral(0, 1);
+        spi_transfer(0xB7);
+        spi_peripheral(0, 0);
+        flash_address_bytes = 4;
+    }
+
+    return 0;
+}
+
+// Select external flash and send command with address
+void flash_command(uint8_t command, uint32_t address) {
+    spi_peripheral(0, 1);
+    spi_transfer(command);
+    if (flash_address_bytes == 4) {
+        spi_transfer((address >> 24) & 0xFF);
+    }
+    spi_transfer((address >> 16) & 0xFF);
+    spi_transfer((address >> 8) & 0xFF);
+    spi_transfer(address & 0xFF);
+}
+
 // Enable writing to external flash
 uint8_t flash_write_enable(void) {
     spi_peripheral(0, 1);
@@ -13,8 +105,73 @@ uint8_t flash_write_enable(void) {
     return 0;
 }
 
-// Wait until external flash is not busy
+// Read status register
+static uint8_t flash_status(uint8_t command) {
+    spi_peripheral(0, 1);
+    spi_transfer(command);
+    uint8_t status = spi_transfer(0xFF);
+    spi_peripheral(0, 0);
+
+    return status;
+}
+
+// Start erasing 64 kB block without waiting
+void flash_erase(uint32_t address) {
+    flash_wait();
+    flash_write_enable(); // Enable writing
+    flash_command(flash_erase_cmd, address);
+    spi_peripheral(0, 0);
+
+    flash_erasing = 1;
+}
+
+// Check if external flash is busy
+uint8_t flash_busy(void) {
+    if (flash_status(0x05) & 1) {
+        return 1;
+    }
+    if (flash_erasing == 1) {
+        flash_erasing = 0;
+    }
+
+    return 0;
+}
+
+// Suspend running erase so that flash can be read, otherwise wait until not busy
+uint8_t flash_suspend(void) {
+    if (flash_erasing == 1 && flash_busy()) {
+        spi_peripheral(0, 1);
+        spi_transfer(0x75);
+        spi_peripheral(0, 0);
+
+        while (flash_status(0x05) & 1); // Wait for suspend latency
+
+        // Erase may have finished before suspend
+        if (flash_status(0x35) & (1 << 7)) {
+            flash_erasing = 2;
+            return 0;
+        }
+        flash_erasing = 0;
+    }
+
+    return flash_wait();
+}
+
+// Resume suspended erase
+void flash_resume(void) {
+    if (flash_erasing == 2) {
+        spi_peripheral(0, 1);
+        spi_transfer(0x7A);
+        spi_peripheral(0, 0);
+
+        flash_erasing = 1;
+    }
+}
+
+// Wait until external flash is not busy, resuming suspended erase
 uint8_t flash_wait(void) {
+    flash_resume();
+
     spi_peripheral(0, 1);
     spi_transfer(0x05);
     spi_transfer(0xFF);
@@ -27,6 +184,7 @@ uint8_t flash_wait(void) {
         rx_val = spi_transfer(0xFF);
         spi_peripheral(0, 0);
     }
+    flash_erasing = 0;
 
     return 0;
 }
@@ -13,6 +13,9 @@ uint8_t gpio_write(uint8_t port, uint8_t pin, uint8_t value) {
         }
     }
     else if (port == 1) {
+        if ((1 << pin) & GPIO_DONE_MASK) {
+            return 1; // Reserved for powering off
+        }
         if(value) {
             PORTB.OUTSET = (1 << pin);
         }
@@ -34,12 +37,29 @@ void dac_enable(uint8_t en) {
     DAC0.CTRLA = (DAC0.CTRLA & ~(1 << 6)) | (en << 6);
 }
 
+// Route Timer A split mode outputs to PB0-PB2 by mask, overriding GPIO
+
+void pwm_enable(uint8_t mask) {
+    TCA0.SPLIT.CTRLB = mask & 0x7;
+}
+
+void pwm_write(uint8_t channel, uint8_t duty) {
+    if (channel == 0) {
+        TCA0.SPLIT.LCMP0 = duty;
+    }
+    else if (channel == 1) {
+        TCA0.SPLIT.LCMP1 = duty;
+    }
+    else if (channel == 2) {
+        TCA0.SPLIT.LCMP2 = duty;
+    }
+}
+
 void gpio_init(void) {
     PORTA.DIRSET = (1 << 5) | (1 << 4) | (1 << 3) | (1 << 1);
     PORTB.DIRSET = (1 << 3) | (1 << 2) | (1 << 1) | 1;
     
     //PORTA.PIN2CTRL = (1 << 3);    // Enable MISO pull-up resistor
-    PORTA.PIN7CTRL = (1 << 3) | 0x3;    // Enable mode switch pull-up resistor and falling-edge interrupt
     
     CPUINT.STATUS |= 1 << 7;
     
@@ -4,36 +4,53 @@
 #include <avr/interrupt.h>
 #include <string.h>
 #include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include "petitfs/diskio.h"
 #include "petitfs/pff.h"
 
+#include "ulv.h"
 #include "main.h"
+#include "button.h"
 #include "gpio.h"
+#include "mulaw.h"
 #include "spi.h"
 #include "flash.h"
+#include "power.h"
+#include "state.h"
+#include "timer.h"
 
 #define BUFFER_SIZE 1024
 
+#ifndef F_CPU
+#define F_CPU 10000000UL
+#endif
+
+// Uncomment to drive PORTB pin high from reset until the first audio sample
+//#define TTFS_PIN 3
+
 FATFS file_system;
-uint8_t reset = 0;
 uint8_t sd_initialized = 0;
 uint8_t file_num = 0;
+uint32_t ttfs_ticks = 0; // Timer ticks from reset to first audio sample
 
 // Initialize main and Timer A clocks
 
 uint8_t clk_init(void) {
     while (!(CLKCTRL.MCLKSTATUS & (1 << 4)));
-    *((volatile unsigned char*) (0x0030 + 0x04)) = 0xD8; // Unlock IOREG
-    CLKCTRL.MCLKCTRLB = 1; // Set CPU clock to 10 MHz
+    _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, 1); // Set CPU clock to 10 MHz
+
+    // Start Timer A clock at 39.0625 kHz, split into 8-bit PWM at 153 Hz
+    TCA0.SPLIT.CTRLD = 1; // Enable split mode
+    TCA0.SPLIT.LPER = 0xFE; // Duty 0xFF is always on
+    TCA0.SPLIT.HPER = 0xFE;
+    TCA0.SPLIT.CTRLA = (0x6 << 1) | 1;
 
-    // Start Timer A clock at 39.0625 kHz
-    TCA0.SINGLE.PER = 0xFFFF;
-    TCA0.SINGLE.CTRLA = (0x6 << 1) | 1;
+    timer_init();
 
     return 0;
 }
 
-// Disable peripherals and power down
+// Disable peripherals and power off
 
 void shutdown(void) {
     disable_sd_card();
@@ -47,51 +64,46 @@ void shutdown(void) {
     PORTB.OUTCLR = 0xFF;
     PORTB.DIRSET = 0;
 
+    // Cut power with timer chip, sleep if it is not wired or power remains
+    power_off();
+    timer_delay(TIMER_MS(100));
+    timer_stop(TIMER_IDLE);
+
     SLPCTRL.CTRLA = (0x2 << 1) | 1; // Set sleep mode to power down
     sleep_mode(); // Sleep
 }
 
-// Wait for Timer A clocks (25.6 us per clock)
+// Step DAC towards center value, run from timer
 
-uint8_t delay_clks(uint8_t delay) {
-    uint16_t end_val = TCA0.SINGLE.CNT + delay;
+static uint8_t ramp_level = 0xFF;
 
-    if (end_val < TCA0.SINGLE.CNT) {
-        while (!(TCA0.SINGLE.INTFLAGS & 1));
-        TCA0.SINGLE.INTFLAGS |= 1;
+static void dac_ramp(void) {
+    dac_write(--ramp_level);
+    if (ramp_level == 0x80) {
+        timer_stop(TIMER_DAC);
     }
-
-    while (TCA0.SINGLE.CNT < end_val);
-
-    return 0;
 }
 
-// Wait for milliseconds (max. 1680)
-
-uint8_t delay_ms(uint16_t delay) {
-    uint16_t end_val = TCA0.SINGLE.CNT + delay * 39;
-
-    if (end_val < TCA0.SINGLE.CNT) {
-        while (!(TCA0.SINGLE.INTFLAGS & 1));
-        TCA0.SINGLE.INTFLAGS |= 1;
-    }
+// Toggle beep square wave
 
-    while (TCA0.SINGLE.CNT < end_val);
+static uint8_t beep_level = 0;
 
-    return 0;
+static void beep_toggle(void) {
+    beep_level ^= 0x0F;
+    dac_write(beep_level);
 }
 
 // Beep for given number of times
 
 void beep(uint8_t beeps) {
     for (uint8_t i = 0; i < beeps; i++) {
-        for (uint8_t j = 0; j < 244; j++) {
-            dac_write(0);
-            delay_clks(32);
-            dac_write(0x0F);
-            delay_clks(32);
-        }
-        delay_ms(800);
+        beep_level = 0;
+        dac_write(beep_level);
+        timer_start(TIMER_DAC, 32, 32, beep_toggle);
+        timer_delay(244 * 64);
+        timer_stop(TIMER_DAC);
+
+        timer_delay(TIMER_MS(800));
     }
 }
 
@@ -109,7 +121,9 @@ uint8_t init_sd_card(void) {
 
     /* Initialize physical drive */
     status = disk_initialize();
-    if (status == STA_NODISK) {
+    if (status) {
+        SPI0.CTRLA = SPI0.CTRLA & ~(0x3 << 1);
+        SPI0.CTRLA |= (spi_presc << 1); // Reset SPI freq. setting
         return 1;
     }
 
@@ -143,8 +157,8 @@ uint8_t open_file(uint8_t f_num) {
     if (f_num > 10)
         return 1;
 
-    if (!sd_initialized) {
-        init_sd_card();
+    if (!sd_initialized && init_sd_card()) {
+        return 3;
     }
 
     // Give empty clocks for SD card
@@ -175,20 +189,39 @@ uint8_t read_file(void) {
         return 1;
     }
     beep(file_num);
-    delay_ms(1200);
+    timer_delay(TIMER_MS(1200));
 
     gpio_write(1, 2, 0);
     gpio_write(1, 3, 1);
 
-    uint16_t rx_bytes;
+    UINT rx_bytes;
     uint8_t rx_buff[BUFFER_SIZE];
     uint8_t highest_byte;
 
     uint16_t erases = 0;
-    uint16_t flash_address = 0;
-    uint8_t flash_i = 0;
+    uint32_t flash_address = 0;
+
+    // Resume interrupted load after last saved block
+    if (song_state.status == STATE_LOADING && song_state.song == file_num && song_state.blocks) {
+        // Compare header and file size, a replaced file is loaded from the start
+        uint32_t size = 0;
+        pf_read(rx_buff, 4, &rx_bytes);
+        for (uint8_t i = 0; i < 4; i++) {
+            size |= (uint32_t) rx_buff[i] << (8 * i);
+        }
+
+        if (rx_bytes == 4 && size == song_state.size && file_system.fsize == (size & ULV_SIZE_MASK) + 4
+                && pf_lseek((DWORD) song_state.blocks << 16) == FR_OK) {
+            highest_byte = size >> 24;
+            erases = 1;
+            flash_address = (uint32_t) song_state.blocks << 16;
+        } else {
+            pf_lseek(0);
+        }
+    }
+
     while (1) {
-        if (reset) {
+        if (button_event >= BUTTON_EVENT_LONG) {
             spi_peripheral(0, 0);
             return 2;
         }
@@ -202,7 +235,12 @@ uint8_t read_file(void) {
             for (uint8_t i = 0; i < 4; i++) {
                 bytes |= (uint32_t) rx_buff[i] << (8 * i);
             }
-            bytes += 4;
+            song_state.size = bytes;
+            bytes = (bytes & ULV_SIZE_MASK) + 4;
+
+            if (bytes > flash_size) {
+                return 3;
+            }
 
             erases = (bytes >> 16);
             if (bytes & 0xFFFF) {
@@ -211,56 +249,61 @@ uint8_t read_file(void) {
 
             rx_buff[3] = 0xFF; // Erase highest byte count byte until finished
 
+            // Save load state before erasing, an interrupted erase restarts the load
+            song_state.song = file_num;
+            song_state.status = STATE_LOADING;
+            song_state.blocks = 0;
+            state_save();
+
             for (uint16_t i = 0; i < erases; i++) {
-                if (reset) {
+                if (button_event >= BUTTON_EVENT_LONG) {
                     spi_peripheral(0, 0);
                     return 2;
                 }
 
-                PORTB.OUTTGL = 1 << 2;
+                PORTB.OUTTGL = (1 << 2) & ~GPIO_DONE_MASK;
                 // Erase 64kB block
-                flash_write_enable(); // Enable writing
-                spi_peripheral(0, 1);
-                spi_transfer(0xD8);
-                spi_transfer(i);
-                spi_transfer(0x00);
-                spi_transfer(0x00);
-                spi_peripheral(0, 0);
-
-                // Wait for erase
-                flash_wait();
+                flash_erase((uint32_t) i << 16);
+                power_activity = 1;
+
+                // Wait for erase, a button event leaves it running for playback to suspend
+                while (flash_busy()) {
+                    if (button_event >= BUTTON_EVENT_LONG) {
+                        return 2;
+                    }
+                }
             }
             gpio_write(1, 2, 0);
             gpio_write(1, 3, 1);
         }
 
-        PORTB.OUTTGL = 1 << 3 | 1 << 2;
-        flash_i = 0;
+        PORTB.OUTTGL = (1 << 3 | 1 << 2) & ~GPIO_DONE_MASK;
         for (uint16_t i = 0; i < rx_bytes; i++) {
-            if (reset) {
+            if (button_event >= BUTTON_EVENT_LONG) {
                 spi_peripheral(0, 0);
                 return 2;
             }
 
-            if (!flash_i) {
+            if (!(flash_address & (flash_page - 1))) {
 
                 spi_peripheral(0, 0);
 
                 // Wait until not busy
                 flash_wait();
 
-                // Write
-                flash_write_enable(); // Enable writing
-                spi_peripheral(0, 1);
-                spi_transfer(0x02);
-                spi_transfer((flash_address >> 8) & 0xFF);
-                spi_transfer(flash_address & 0xFF);
-                spi_transfer(0x00);
+                // Save progress when previous blocks are programmed
+                if (!(flash_address & (((uint32_t) STATE_PROGRESS_BLOCKS << 16) - 1)) && flash_address) {
+                    song_state.blocks = flash_address >> 16;
+                    state_save();
+                }
 
-                flash_address++;
+                // Write page
+                flash_write_enable(); // Enable writing
+                flash_command(0x02, flash_address);
+                power_activity = 1;
             }
             spi_transfer(rx_buff[i]);
-            flash_i++;
+            flash_address++;
         }
         spi_peripheral(0, 0);
 
@@ -274,14 +317,13 @@ uint8_t read_file(void) {
     // Write first byte to indicate finished read
     flash_write_enable(); // Enable writing
 
-    spi_peripheral(0, 1);
-    spi_transfer(0x02);
-    spi_transfer(0x00);
-    spi_transfer(0x00);
-    spi_transfer(0x03);
+    flash_command(0x02, 3);
     spi_transfer(highest_byte);
     spi_peripheral(0, 0);
 
+    song_state.status = STATE_LOADED;
+    state_save();
+
     gpio_write(1, 3, 0);
 
     disable_sd_card();
@@ -289,175 +331,380 @@ uint8_t read_file(void) {
     return 0;
 }
 
-// Play song from external flash memory
+// Start reading song from external flash memory and parse header
 
-uint8_t play(void) {
-    // Wait until not busy
-    flash_wait();
+uint8_t read_header(struct ulv_header *header) {
+    // Suspend erase or wait until not busy
+    flash_suspend();
 
     // Start read
-    spi_peripheral(0, 1);
-    spi_transfer(0x03);
-    spi_transfer(0x00);
-    spi_transfer(0x00);
-    spi_transfer(0x00);
+    flash_command(0x03, 0);
 
     // Read number of data bytes
-    uint32_t bytes = 0;
+    uint32_t size = 0;
     for (int i = 0; i < 4; i++) {
-        bytes |= (uint32_t) spi_transfer(0xFF) << (8 * i);
+        size |= (uint32_t) spi_transfer(0xFF) << (8 * i);
     }
 
-    if (!(bytes >> 24)) {
-        uint8_t mech_byte = 0;
-        uint16_t j = 0;
-        for (uint32_t i = 0; i < bytes; i++) {
-            if (reset)
-                return 1;
-
-            if (j == 0) { // Play next mech sample
-                if (!mech_byte) {
-                    mech_byte = spi_transfer(0xFF); // Read next byte
-                    i++;
-
-                    // Play mech sample
-                    gpio_write(1, 0, mech_byte & 1);
-                    gpio_write(1, 1, mech_byte & (1 << 1));
-                    gpio_write(1, 2, mech_byte & (1 << 2));
-                    gpio_write(1, 3, mech_byte & (1 << 3));
-
-                    mech_byte = mech_byte | 1;
-
-                    for (uint8_t k = 0; k < 6; k++)
-                        __asm__ __volatile__("nop "); // Adjust timing
-
-                    __asm__ __volatile__("nop "); // Adjust timing
-                    __asm__ __volatile__("nop "); // Adjust timing
-                    __asm__ __volatile__("nop "); // Adjust timing
-                } else {
-                    gpio_write(1, 0, mech_byte & (1 << 4));
-                    gpio_write(1, 1, mech_byte & (1 << 5));
-                    gpio_write(1, 2, mech_byte & (1 << 6));
-                    gpio_write(1, 3, mech_byte & (1 << 7));
-
-                    mech_byte = 0;
-
-                    for (uint8_t k = 0; k < 20; k++)
-                        __asm__ __volatile__("nop "); // Adjust timing
-
-                    __asm__ __volatile__("nop "); // Adjust timing
-                    __asm__ __volatile__("nop "); // Adjust timing
-                    __asm__ __volatile__("nop "); // Adjust timing
-                }
-                j = 746;
-            } else {
-                for (uint8_t k = 0; k < 62; k++)
-                    __asm__ __volatile__("nop "); // Adjust timing
-
-                __asm__ __volatile__("nop "); // Adjust timing
-                __asm__ __volatile__("nop "); // Adjust timing
-                __asm__ __volatile__("nop "); // Adjust timing
-            }
-            j--;
-            dac_write(spi_transfer(0xFF)); // Play next audio sample
-        }
-    } else {
+    if ((size >> 24) == ULV_LOADING || (size & ULV_SIZE_MASK) > flash_size - 4) {
         spi_peripheral(0, 0);
+        flash_resume();
         return 1;
     }
-    spi_peripheral(0, 0);
+
+    header->bytes = size & ULV_SIZE_MASK;
+    header->flags = 0;
+    header->rate = ULV_RATE;
+    header->frame = ULV_FRAME;
+
+    if (size & ULV_EXTENDED) {
+        uint8_t length = spi_transfer(0xFF);
+        header->flags = spi_transfer(0xFF);
+        header->rate = spi_transfer(0xFF);
+        header->rate |= spi_transfer(0xFF) << 8;
+        header->frame = spi_transfer(0xFF);
+        header->frame |= spi_transfer(0xFF) << 8;
+
+        // Skip unknown header fields
+        for (uint8_t i = 6; i < length; i++) {
+            spi_transfer(0xFF);
+        }
+
+        // Sample clock period must fit in 16 bits
+        if (length < 6 || header->bytes < length || header->rate <= F_CPU / 0x10000 || header->frame < 2) {
+            spi_peripheral(0, 0);
+            flash_resume();
+            return 1;
+        }
+        header->bytes -= length;
+    }
+
     return 0;
 }
 
-// Mode button interrupt
+// Sample clock, periods are lengthened by one clock by the accumulated fraction
 
-ISR(PORTA_PORT_vect) {
-    PORTA.INTFLAGS |= 1 << 7;
+static uint16_t clock_rate;
+static uint16_t clock_period;
+static uint16_t clock_fraction;
+static uint16_t clock_accumulator;
 
-    gpio_write(1, 0, 0);
-    gpio_write(1, 1, 0);
-    gpio_write(1, 2, 0);
-    gpio_write(1, 3, 0);
+static void sample_clock_start(uint16_t rate) {
+    clock_rate = rate;
+    clock_period = F_CPU / rate;
+    clock_fraction = F_CPU % rate;
+    clock_accumulator = 0;
 
-    uint8_t wait_time = 0;
-    while (!(PORTA.IN & (1 << 7)) && wait_time < 50) {
-        delay_ms(10);
-        wait_time++;
+    TCB1.CCMP = clock_period - 1;
+    TCB1.CTRLB = 0x0; // Periodic interrupt mode
+    TCB1.INTFLAGS = 1;
+    TCB1.CTRLA = (0x0 << 1) | 1; // Use CPU clock and enable
+}
 
-        if (wait_time >= 50) {
-            break;
+// Set length of next sample clock period
+
+static inline void sample_clock_next(void) {
+    clock_accumulator += clock_fraction;
+    if (clock_accumulator >= clock_rate) {
+        clock_accumulator -= clock_rate;
+        TCB1.CCMP = clock_period;
+    } else {
+        TCB1.CCMP = clock_period - 1;
+    }
+}
+
+// Requantise sample with 8 fractional bits for DAC, feeding back the rounding error
+
+static uint8_t dac_error = 0;
+
+static inline uint8_t requantise(uint16_t value) {
+    value += dac_error;
+    dac_error = value & 0xFF;
+
+    return value >> 8;
+}
+
+// Wait for sample clock and play audio sample
+
+static inline void sample_output(uint8_t sample) {
+    while (!(TCB1.INTFLAGS & 1));
+    TCB1.INTFLAGS = 1;
+
+    dac_write(sample);
+
+    sample_clock_next();
+}
+
+// Sample clock interrupt, wakes up sample_sleep
+
+static volatile uint8_t clock_tick = 0;
+
+ISR(TCB1_INT_vect) {
+    TCB1.INTFLAGS = 1;
+    clock_tick = 1;
+}
+
+// Sleep in idle mode for sample clocks while DAC output does not change
+
+static void sample_sleep(uint16_t samples) {
+    clock_tick = 0;
+    TCB1.INTCTRL = 1;
+    SLPCTRL.CTRLA = (0x0 << 1) | 1; // Set sleep mode to idle
+
+    while (samples--) {
+        cli(); // Block interrupts
+        while (!clock_tick) {
+            sei(); // Unblock interrupts, sleep is executed before any interrupt
+            sleep_cpu();
+            cli(); // Block interrupts
         }
+        clock_tick = 0;
+        sei(); // Unblock interrupts
+
+        sample_clock_next();
     }
-    if (wait_time < 50)
-        return;
 
-    gpio_write(1, 2, 1);
-    gpio_write(1, 3, 1);
+    SLPCTRL.CTRLA = 0;
+    TCB1.INTCTRL = 0;
+}
+
+// Play mech sample from low nibble unless button is driving eye LEDs
+
+static uint8_t play_flags;
+static uint8_t mech_duty[3]; // Legs, mouth and left eye PWM duty of current frame
+
+static void play_mech(uint8_t mech) {
+    power_activity = 1;
+    if (button_state >= BUTTON_HELD) {
+        pwm_enable(0); // Return pins to GPIO set by button
+    } else if (play_flags & ULV_PWM) {
+        pwm_write(0, (mech & 1) ? mech_duty[0] : 0);
+        pwm_write(1, (mech & (1 << 1)) ? mech_duty[1] : 0);
+        pwm_write(2, (mech & (1 << 2)) ? mech_duty[2] : 0);
+        pwm_enable(0x7);
+        gpio_write(1, 3, mech & (1 << 3)); // No PWM output on right eye pin
+    } else {
+        gpio_write(1, 0, mech & 1);
+        gpio_write(1, 1, mech & (1 << 1));
+        gpio_write(1, 2, mech & (1 << 2));
+        gpio_write(1, 3, mech & (1 << 3));
+    }
+}
 
-    wait_time = 0;
-    while (!(PORTA.IN & (1 << 7))) {
-        delay_ms(10);
-        wait_time++;
+// Play stored audio sample
 
-        if (wait_time >= 150) {
-            gpio_write(1, 2, 0);
-            gpio_write(1, 3, 0);
-            while (!(PORTA.IN & (1 << 7)));
-            break;
+static uint16_t last_value;
+
+static inline void play_sample(uint8_t sample) {
+    // Expand companded audio, values are DAC samples with 8 fractional bits
+    uint16_t value = (play_flags & ULV_MULAW) ? pgm_read_word(&mulaw_table[sample]) : (uint16_t) sample << 8;
+
+    // Interpolate half rate audio linearly
+    if (play_flags & ULV_HALF_RATE) {
+        sample_output(requantise((last_value >> 1) + (value >> 1)));
+    }
+    sample_output(requantise(value)); // Play next audio sample
+    last_value = value;
+}
+
+// Play song with frames aligned to flash pages
+
+static uint8_t play_pages(uint32_t bytes) {
+    while (bytes) {
+        if (button_event >= BUTTON_EVENT_LONG) {
+            return 1;
+        }
+
+        uint8_t samples = bytes > 0xFF ? 0xFF : bytes - 1;
+        bytes -= (uint16_t) samples + 1;
+
+        uint8_t mech_byte = spi_transfer(0xFF);
+        play_mech(mech_byte);
+
+        for (uint8_t i = 0; i < samples; i++) {
+            if (i == (ULV_PAGE_FRAME + 1) >> 1) {
+                play_mech(mech_byte >> 4);
+            }
+            play_sample(spi_transfer(0xFF));
         }
     }
-    if (wait_time < 150) {
-        cli(); // Block interrupts
-        shutdown();
-        sei(); // Unblock interrupts
+
+    return 0;
+}
+
+// Play song with frames of any length
+
+static uint8_t play_frames(uint32_t bytes, uint16_t frame) {
+    uint8_t mech_byte = 0;
+    uint16_t j = 0;
+    for (uint32_t i = 0; i < bytes; i++) {
+        if (button_event >= BUTTON_EVENT_LONG) {
+            return 1;
+        }
+
+        if (j == 0) { // Play next mech sample
+            if (!mech_byte) {
+                mech_byte = spi_transfer(0xFF); // Read next byte
+                i++;
+
+                // Read PWM duties of frame
+                if (play_flags & ULV_PWM) {
+                    for (uint8_t k = 0; k < 3; k++) {
+                        mech_duty[k] = spi_transfer(0xFF);
+                    }
+                    i += 3;
+                }
+
+                play_mech(mech_byte);
+
+                mech_byte = mech_byte | 1;
+                j = (frame + 1) >> 1;
+            } else {
+                play_mech(mech_byte >> 4);
+
+                mech_byte = 0;
+                j = frame >> 1;
+            }
+        }
+        j--;
+
+        uint8_t sample = spi_transfer(0xFF); // Read next audio sample
+
+        // Repeat previous sample for run length, runs end at mech samples
+        if ((play_flags & ULV_RLE) && !sample) {
+            uint8_t run = spi_transfer(0xFF);
+            i++;
+
+            if (run > j + 1) {
+                run = j + 1;
+            }
+            j -= run - 1;
+
+            sample_sleep((play_flags & ULV_HALF_RATE) ? run << 1 : run);
+            continue;
+        }
+
+        play_sample(sample);
     }
 
+    return 0;
+}
+
+// Play song from external flash memory
+
+uint8_t play(void) {
+    struct ulv_header header;
+    if (read_header(&header)) {
+        return 1;
+    }
+
+    // Finish start-up DAC ramp before first sample
+    timer_wait(TIMER_DAC);
+
+    sample_clock_start(header.rate);
+
+    if (!ttfs_ticks) {
+        ttfs_ticks = timer_ticks();
+#ifdef TTFS_PIN
+        gpio_write(1, TTFS_PIN, 0);
+#endif
+    }
+
+    play_flags = header.flags;
+    last_value = 0x8000;
+    if (play_flags & ULV_PWM) {
+        PORTB.OUTCLR = 0x7; // Motors and left eye off when button disables PWM
+    }
+
+    uint8_t result;
+    if ((header.flags & (ULV_PAGED | ULV_RLE | ULV_PWM)) == ULV_PAGED && header.frame == ULV_PAGE_FRAME) {
+        result = play_pages(header.bytes);
+    } else {
+        result = play_frames(header.bytes, header.frame);
+    }
+
+    TCB1.CTRLA = 0;
+    pwm_enable(0);
+    spi_peripheral(0, 0);
+    flash_resume();
+    return result;
+}
+
+// Select next song from microSD card, wrapping to first song
+
+uint8_t next_song(void) {
     file_num++;
     if (file_num != 1 && open_file(file_num)) {
         file_num = 1;
     }
 
-    if (!open_file(file_num)) {
-        reset = 1;
+    if (open_file(file_num)) {
+        return 1;
     }
+
+    song_state.selected = file_num;
+    state_save();
+
+    return 0;
 }
 
-// Loop function
+// Loop function, handles button events between playback and loading
 
 uint8_t loop(void) {
-    if (!reset && play()) {
-        if (!reset) {
-            file_num = 1;
+    // Play loaded song, otherwise resume or start loading selected song
+    if (button_event < BUTTON_EVENT_LONG && (song_state.status == STATE_LOADING || play())) {
+        if (button_event < BUTTON_EVENT_LONG) {
+            if (!file_num) {
+                file_num = 1;
+            }
             if (!read_file()) {
                 play();
             }
         }
     }
-    if (reset) {
-        reset = 0;
-        read_file();
+
+    uint8_t event = button_take();
+    if (event == BUTTON_EVENT_EXTRA_LONG) {
+        if (!next_song()) {
+            read_file();
+        }
         return 1;
     }
 
     return 0;
 }
 
-// Enter function
+// Initialize peripherals, saved state and external flash
 
-int main(void) {
+uint8_t startup(void) {
     cli(); // Block interrupts
     clk_init();
+#ifdef TTFS_PIN
+    PORTB.DIRSET = 1 << TTFS_PIN;
+    gpio_write(1, TTFS_PIN, 1);
+#endif
     gpio_init();
-    
-    // Slowly move DAC to center value
-    for(uint8_t i = 0; i < 128; i++) {
-        dac_write(0xFF - i);
-        delay_clks(1);
-    }
-    
-    spi_init();
+    button_init();
+    state_load();
+    file_num = song_state.status == STATE_LOADING ? song_state.song : song_state.selected;
+    spi_init(); // Wake up flash before DAC ramp
+    flash_init();
+
+    // Slowly move DAC to center value while first song header is read, measuring time to first sample
+    ttfs_ticks = 0;
+    ramp_level = 0xFF;
+    timer_start(TIMER_DAC, TIMER_MIN_TICKS, TIMER_MIN_TICKS, dac_ramp);
     sei(); // Unblock interrupts
-    
+
+    return 0;
+}
+
+// Enter function
+
+int main(void) {
+    startup();
+    power_init(); // Start inactivity timeout
+
     while (loop());
     shutdown();
 
@@ -0,0 +1,40 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "mulaw.h"
+
+// G.711 mu-law code to DAC sample with 8 fractional bits
+const uint16_t mulaw_table[256] PROGMEM = {
+    0x0281, 0x067D, 0x0A79, 0x0E75, 0x1271, 0x166D, 0x1A69, 0x1E65,
+    0x2261, 0x265D, 0x2A59, 0x2E55, 0x3251, 0x364D, 0x3A49, 0x3E45,
+    0x4142, 0x4340, 0x453E, 0x473C, 0x493A, 0x4B38, 0x4D36, 0x4F34,
+    0x5132, 0x5330, 0x552E, 0x572C, 0x592A, 0x5B28, 0x5D26, 0x5F24,
+    0x60A2, 0x61A1, 0x62A0, 0x639F, 0x649E, 0x659D, 0x669C, 0x679B,
+    0x689A, 0x6999, 0x6A98, 0x6B97, 0x6C96, 0x6D95, 0x6E94, 0x6F93,
+    0x7053, 0x70D2, 0x7152, 0x71D1, 0x7251, 0x72D0, 0x7350, 0x73CF,
+    0x744F, 0x74CE, 0x754E, 0x75CD, 0x764D, 0x76CC, 0x774C, 0x77CB,
+    0x782B, 0x786B, 0x78AA, 0x78EA, 0x792A, 0x796A, 0x79A9, 0x79E9,
+    0x7A29, 0x7A69, 0x7AA8, 0x7AE8, 0x7B28, 0x7B68, 0x7BA7, 0x7BE7,
+    0x7C17, 0x7C37, 0x7C57, 0x7C77, 0x7C96, 0x7CB6, 0x7CD6, 0x7CF6,
+    0x7D16, 0x7D36, 0x7D56, 0x7D76, 0x7D95, 0x7DB5, 0x7DD5, 0x7DF5,
+    0x7E0D, 0x7E1D, 0x7E2D, 0x7E3D, 0x7E4D, 0x7E5D, 0x7E6D, 0x7E7D,
+    0x7E8C, 0x7E9C, 0x7EAC, 0x7EBC, 0x7ECC, 0x7EDC, 0x7EEC, 0x7EFC,
+    0x7F08, 0x7F10, 0x7F18, 0x7F20, 0x7F28, 0x7F30, 0x7F38, 0x7F40,
+    0x7F48, 0x7F50, 0x7F58, 0x7F60, 0x7F68, 0x7F70, 0x7F78, 0x7F80,
+    0xFC7E, 0xF882, 0xF486, 0xF08A, 0xEC8E, 0xE892, 0xE496, 0xE09A,
+    0xDC9E, 0xD8A2, 0xD4A6, 0xD0AA, 0xCCAE, 0xC8B2, 0xC4B6, 0xC0BA,
+    0xBDBD, 0xBBBF, 0xB9C1, 0xB7C3, 0xB5C5, 0xB3C7, 0xB1C9, 0xAFCB,
+    0xADCD, 0xABCF, 0xA9D1, 0xA7D3, 0xA5D5, 0xA3D7, 0xA1D9, 0x9FDB,
+    0x9E5D, 0x9D5E, 0x9C5F, 0x9B60, 0x9A61, 0x9962, 0x9863, 0x9764,
+    0x9665, 0x9566, 0x9467, 0x9368, 0x9269, 0x916A, 0x906B, 0x8F6C,
+    0x8EAC, 0x8E2D, 0x8DAD, 0x8D2E, 0x8CAE, 0x8C2F, 0x8BAF, 0x8B30,
+    0x8AB0, 0x8A31, 0x89B1, 0x8932, 0x88B2, 0x8833, 0x87B3, 0x8734,
+    0x86D4, 0x8694, 0x8655, 0x8615, 0x85D5, 0x8595, 0x8556, 0x8516,
+    0x84D6, 0x8496, 0x8457, 0x8417, 0x83D7, 0x8397, 0x8358, 0x8318,
+    0x82E8, 0x82C8, 0x82A8, 0x8288, 0x8269, 0x8249, 0x8229, 0x8209,
+    0x81E9, 0x81C9, 0x81A9, 0x8189, 0x816A, 0x814A, 0x812A, 0x810A,
+    0x80F2, 0x80E2, 0x80D2, 0x80C2, 0x80B2, 0x80A2, 0x8092, 0x8082,
+    0x8073, 0x8063, 0x8053, 0x8043, 0x8033, 0x8023, 0x8013, 0x8003,
+    0x7FF7, 0x7FEF, 0x7FE7, 0x7FDF, 0x7FD7, 0x7FCF, 0x7FC7, 0x7FBF,
+    0x7FB7, 0x7FAF, 0x7FA7, 0x7F9F, 0x7F97, 0x7F8F, 0x7F87, 0x7F80
+};
@@ -0,0 +1,46 @@
+#include <avr/io.h>
+
+#include "power.h"
+#include "button.h"
+#include "gpio.h"
+#include "timer.h"
+
+#define POWER_IDLE_S 60 // Seconds without playback, loading or button presses before stopping
+#define POWER_HUNG_S 10 // Seconds after stopping before cutting power regardless
+
+volatile uint8_t power_activity = 0; // Set by playback and loading, cleared every second
+static uint8_t idle_seconds = 0;
+
+// Assert TPL5110 DONE to cut 3.3 V rail, no effect unless DONE is wired to a pin
+
+void power_off(void) {
+#ifdef GPIO_DONE_PIN
+    PORTB.OUTSET = GPIO_DONE_MASK;
+#endif
+}
+
+// Count seconds without activity, run from timer
+
+static void power_idle(void) {
+    if (power_activity || button_state != BUTTON_IDLE) {
+        power_activity = 0;
+        idle_seconds = 0;
+        return;
+    }
+
+    idle_seconds++;
+    if (idle_seconds == POWER_IDLE_S) {
+        // Stop like a long press, loop then returns and shuts down
+        if (button_event < BUTTON_EVENT_LONG) {
+            button_event = BUTTON_EVENT_LONG;
+        }
+    } else if (idle_seconds == POWER_IDLE_S + POWER_HUNG_S) {
+        power_off(); // Flash or microSD card is not responding
+    }
+}
+
+// Start inactivity timeout
+
+void power_init(void) {
+    timer_start(TIMER_IDLE, TIMER_MS(1000), TIMER_MS(1000), power_idle);
+}
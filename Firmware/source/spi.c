@@ -2,8 +2,11 @@
 #include <avr/io.h>
 
 #include "gpio.h"
+#include "trace.h"
 
 uint8_t spi_transfer(uint8_t tx_value) {
+    trace_byte(tx_value);
+
     while (!(SPI0.INTFLAGS & (1 << 5))); // Wait for empty data buffer
     SPI0.DATA = tx_value;
     while (!(SPI0.INTFLAGS & (1 << 6))); // Wait for transmit
@@ -19,6 +22,12 @@ uint8_t spi_transfer(uint8_t tx_value) {
 }
 
 void spi_peripheral(uint8_t peripheral, uint8_t enable) {
+    if (enable) {
+        trace_select(peripheral);
+    } else {
+        trace_deselect(peripheral);
+    }
+
     if (peripheral == 0) {
         gpio_write(0, 4, !enable);
     } else if (peripheral == 1) {
@@ -0,0 +1,26 @@
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "state.h"
+
+static struct song_state EEMEM state_eeprom;
+struct song_state song_state;
+
+// Read song state from EEPROM, erased EEPROM reads as unknown state
+
+void state_load(void) {
+    eeprom_read_block(&song_state, &state_eeprom, sizeof(song_state));
+
+    if (song_state.selected > 10) {
+        song_state.selected = 0;
+    }
+    if (song_state.status > STATE_LOADED) {
+        song_state.status = STATE_UNKNOWN;
+    }
+}
+
+// Write changed bytes of song state to EEPROM
+
+void state_save(void) {
+    eeprom_update_block(&song_state, &state_eeprom, sizeof(song_state));
+}
@@ -0,0 +1,152 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+// Software timer slot
+struct timer_slot {
+    uint32_t deadline;
+    uint32_t period; // Zero for one-shot
+    void (*callback)(void);
+    volatile uint8_t running; // Cleared by interrupt
+};
+
+static struct timer_slot slots[TIMER_SLOTS];
+static volatile uint32_t timer_base = 0; // Ticks at last Timer B wrap
+
+// Start Timer B from Timer A clock, counting up to next deadline from zero ticks
+
+void timer_init(void) {
+    timer_base = 0;
+    for (uint8_t i = 0; i < TIMER_SLOTS; i++) {
+        slots[i].running = 0;
+    }
+
+    TCB0.CCMP = 0xFFFF;
+    TCB0.CTRLB = 0x0; // Periodic interrupt mode
+    TCB0.INTFLAGS = 1;
+    TCB0.INTCTRL = 1; // Enable capture interrupt
+    TCB0.CTRLA = (0x2 << 1) | 1; // Use Timer A clock and enable
+}
+
+// Read 32-bit tick count
+
+uint32_t timer_ticks(void) {
+    uint32_t ticks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint16_t cnt = TCB0.CNT;
+        ticks = timer_base;
+
+        // Wrapped after interrupts were blocked
+        if (TCB0.INTFLAGS & 1) {
+            cnt = TCB0.CNT;
+            ticks += (uint32_t) TCB0.CCMP + 1;
+        }
+        ticks += cnt;
+    }
+
+    return ticks;
+}
+
+// Set Timer B top to earliest deadline, called with interrupts blocked
+
+static void timer_schedule(void) {
+    if (TCB0.INTFLAGS & 1) {
+        return; // Interrupt is pending and will reschedule
+    }
+
+    uint16_t cnt = TCB0.CNT;
+    uint32_t now = timer_base + cnt;
+    uint32_t wrap = 0x10000; // Counter value at next interrupt, one past top
+
+    for (uint8_t i = 0; i < TIMER_SLOTS; i++) {
+        if (slots[i].running) {
+            int32_t remaining = (int32_t) (slots[i].deadline - now);
+            if (remaining < 0) {
+                remaining = 0;
+            }
+            if ((uint32_t) remaining + cnt < wrap) {
+                wrap = (uint32_t) remaining + cnt;
+            }
+        }
+    }
+
+    // Counter must not pass the new top before it is written, nearer deadlines are late
+    if (wrap < (uint32_t) cnt + 2) {
+        wrap = (uint32_t) cnt + 2;
+    }
+    TCB0.CCMP = wrap - 1;
+}
+
+// Start one-shot (period 0) or periodic timer with callback run in interrupt
+
+void timer_start(uint8_t slot, uint32_t delay, uint32_t period, void (*callback)(void)) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        slots[slot].deadline = timer_ticks() + delay;
+        slots[slot].period = period;
+        slots[slot].callback = callback;
+        slots[slot].running = 1;
+
+        timer_schedule();
+    }
+}
+
+void timer_stop(uint8_t slot) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        slots[slot].running = 0;
+    }
+}
+
+uint8_t timer_running(uint8_t slot) {
+    return slots[slot].running;
+}
+
+// Wait until timer in slot expires or is stopped, sleeping in idle mode
+
+void timer_wait(uint8_t slot) {
+    SLPCTRL.CTRLA = (0x0 << 1) | 1; // Set sleep mode to idle
+
+    cli(); // Block interrupts
+    while (slots[slot].running) {
+        sei(); // Unblock interrupts, sleep is executed before any interrupt
+        sleep_cpu();
+        cli(); // Block interrupts
+    }
+    sei(); // Unblock interrupts
+
+    SLPCTRL.CTRLA = 0;
+}
+
+// Wait for Timer A clocks, sleeping until the timer expires
+
+void timer_delay(uint32_t delay) {
+    timer_start(TIMER_DELAY, delay, 0, 0);
+    timer_wait(TIMER_DELAY);
+}
+
+// Timer B wrap, run expired timers
+
+ISR(TCB0_INT_vect) {
+    timer_base += (uint32_t) TCB0.CCMP + 1;
+    TCB0.INTFLAGS = 1;
+
+    uint32_t now = timer_ticks();
+    for (uint8_t i = 0; i < TIMER_SLOTS; i++) {
+        if (slots[i].running && (int32_t) (slots[i].deadline - now) <= 0) {
+            if (slots[i].period) {
+                slots[i].deadline += slots[i].period;
+            } else {
+                slots[i].running = 0;
+            }
+
+            if (slots[i].callback) {
+                slots[i].callback();
+            }
+        }
+    }
+
+    timer_schedule();
+}
@@ -0,0 +1,97 @@
+#include "trace.h"
+
+#ifdef SPI_TRACE
+
+#include "timer.h"
+
+struct trace trace;
+void (*trace_sink)(const struct trace_record *record);
+
+static struct trace_record current;
+static uint8_t selected = 0;
+static uint8_t address_bytes;
+static uint8_t flash_address_bytes = 3; // 4 after 0xB7
+
+// Address bytes after flash command, none for commands without address
+
+static uint8_t trace_address_bytes(uint8_t command) {
+    switch (command) {
+        case 0x02: // Page program
+        case 0x03: // Read
+        case 0x20: // Erases
+        case 0x52:
+        case 0xD8:
+            return flash_address_bytes;
+        case 0x5A: // SFDP is always read with 3 address bytes
+            return 3;
+    }
+
+    return 0;
+}
+
+// Start record at chip select, selecting an already selected device continues its record
+
+void trace_select(uint8_t device) {
+    if (selected && current.device == device) {
+        return;
+    }
+    if (selected) {
+        trace_deselect(current.device);
+    }
+
+    current.time = timer_ticks();
+    current.address = 0;
+    current.length = 0;
+    current.device = device;
+    current.command = 0;
+    address_bytes = 0;
+    selected = 1;
+}
+
+// Count byte clocked out, keeping the command and the address bytes after it
+
+void trace_byte(uint8_t value) {
+    if (!selected) {
+        return; // Clocks with chip select high
+    }
+
+    if (current.length != 0xFFFF) {
+        current.length++; // Saturates while playback streams a song
+    }
+    if (!current.command) {
+        if (current.device == TRACE_SD && (value & 0xC0) == 0x40) {
+            current.command = value;
+            address_bytes = 4;
+        } else if (current.device == TRACE_FLASH) {
+            current.command = value;
+            address_bytes = trace_address_bytes(value);
+        }
+    } else if (address_bytes) {
+        current.address = (current.address << 8) | value;
+        address_bytes--;
+    }
+}
+
+// Finish record at chip deselect
+
+void trace_deselect(uint8_t device) {
+    if (!selected || current.device != device) {
+        return;
+    }
+    selected = 0;
+
+    if (device == TRACE_FLASH && current.command == 0xB7) {
+        flash_address_bytes = 4;
+    } else if (device == TRACE_FLASH && current.command == 0xE9) {
+        flash_address_bytes = 3;
+    }
+
+    if (trace_sink) {
+        trace_sink(&current);
+    } else {
+        trace.records[trace.count % TRACE_RECORDS] = current;
+        trace.count++;
+    }
+}
+
+#endif
@@ -0,0 +1,80 @@
+from fractions import Fraction
+
+import numpy as np
+import scipy.signal as sps
+from scipy.io import wavfile
+
+block_frames = 1 << 16  # Input samples decoded and resampled at a time
+
+
+def normalise(block):
+    """Downmix a block to mono float32 in the range -1 to 1."""
+    integer = np.issubdtype(block.dtype, np.integer)
+    info = np.iinfo(block.dtype) if integer else None
+    block = block.mean(axis=1) if block.ndim > 1 else block.astype(np.float64 if integer else np.float32)
+    if integer:
+        block = (block - info.min) / (float(info.max) - info.min) * 2 - 1
+    return block.astype(np.float32)
+
+
+def read_blocks(path):
+    """Open an audio file, returning its sample rate and a generator of mono blocks.
+
+    WAV files are memory-mapped where possible, other formats such as FLAC, OGG and MP3 are decoded with soundfile.
+    """
+    if path.lower().endswith(".wav"):
+        try:
+            rate, data = wavfile.read(path, mmap=True)
+        except ValueError:  # Formats that cannot be mapped, e.g. 24-bit
+            rate, data = wavfile.read(path)
+
+        def blocks():
+            for start in range(0, len(data), block_frames):
+                yield normalise(np.asarray(data[start:start + block_frames]))
+        return rate, blocks()
+
+    import soundfile
+    f = soundfile.SoundFile(path)
+
+    def blocks():
+        with f:
+            for block in f.blocks(block_frames, dtype="float32", always_2d=True):
+                yield normalise(block)
+    return f.samplerate, blocks()
+
+
+def resample_blocks(blocks, rate, new_rate):
+    """Polyphase resample a stream of blocks, giving the same samples as resampling the whole signal at once."""
+    ratio = Fraction(new_rate).limit_denominator(1 << 16) / rate
+    up, down = ratio.numerator, ratio.denominator
+    if up == down:
+        yield from blocks
+        return
+
+    # Context on both sides of a segment covers the filter, segments start at multiples of down
+    half = 10 * max(up, down) // up + 1  # Filter half length of resample_poly in input samples
+    pad = down * -(-half // down)
+    step = down * max(1, block_frames // down)
+
+    buffer = np.zeros(0, dtype=np.float32)
+    start = 0  # Input index of buffer[0]
+    done = 0  # Input index up to which output has been produced
+
+    def segment(end, last):
+        context = max(0, done - pad)
+        x = buffer[context - start:end + (0 if last else pad) - start]
+        y = sps.resample_poly(x, up, down)
+        skip = (done - context) * up // down
+        count = -(-end * up // down) - done * up // down
+        return y[skip:skip + count]
+
+    for block in blocks:
+        buffer = np.concatenate((buffer, block))
+        while start + len(buffer) - done >= step + pad:
+            yield segment(done + step, False)
+            done += step
+            drop = max(0, done - pad - start)
+            buffer = buffer[drop:]
+            start += drop
+    if start + len(buffer) > done:
+        yield segment(start + len(buffer), True)
@@ -0,0 +1,65 @@
+import hashlib
+import json
+import os
+import shutil
+import tempfile
+
+import numpy as np
+
+
+class BuildCache:
+    """Files stored under hashes of the inputs they were built from."""
+
+    def __init__(self, directory):
+        self.directory = directory
+        os.makedirs(directory, exist_ok=True)
+
+    @staticmethod
+    def file_hash(path):
+        digest = hashlib.sha256()
+        with open(path, "rb") as f:
+            for block in iter(lambda: f.read(1 << 20), b""):
+                digest.update(block)
+        return digest.hexdigest()
+
+    @staticmethod
+    def key(*parts):
+        """Hash of JSON-serialisable parts, e.g. file hashes and encoder parameters."""
+        return hashlib.sha256(json.dumps(parts).encode()).hexdigest()
+
+    def path(self, key, suffix):
+        return os.path.join(self.directory, key + suffix)
+
+    def store(self, write, key, suffix):
+        """Write a cache entry through a temporary file, so that parallel builds never see partial entries."""
+        fd, temp = tempfile.mkstemp(dir=self.directory, suffix=".tmp")
+        os.close(fd)
+        try:
+            write(temp)
+            os.replace(temp, self.path(key, suffix))
+        finally:
+            if os.path.exists(temp):
+                os.remove(temp)
+
+    def load_array(self, key):
+        try:
+            return np.load(self.path(key, ".npy"))
+        except (OSError, ValueError):
+            return None
+
+    def save_array(self, key, array):
+        def write(temp):
+            with open(temp, "wb") as f:
+                np.save(f, array)
+        self.store(write, key, ".npy")
+
+    def load_file(self, key, target):
+        """Copy a cached file to target, returning whether it was cached."""
+        try:
+            shutil.copyfile(self.path(key, ".ulv"), target)
+            return True
+        except OSError:
+            return False
+
+    def save_file(self, key, source):
+        self.store(lambda temp: shutil.copyfile(source, temp), key, ".ulv")
@@ -0,0 +1,114 @@
+import argparse
+import csv
+import json
+import os
+import sys
+import time
+
+import numpy as np
+from scipy.io import wavfile
+
+import ulv
+
+mech_names = ("legs", "mouth", "left_eye", "right_eye")
+plot_bins = 4000  # Min/max pairs plotted for the whole song
+
+
+def timeline_changes(times, duties):
+    """Reduce mech samples to state changes per actuator."""
+    changes = {}
+    for i, name in enumerate(mech_names):
+        column = duties[:, i]
+        keep = np.concatenate(([True], column[1:] != column[:-1])) if len(column) else np.zeros(0, dtype=bool)
+        changes[name] = [(round(float(t), 6), int(d)) for t, d in zip(times[keep], column[keep])]
+    return changes
+
+
+def write_timeline(path, changes):
+    if path.lower().endswith(".json"):
+        with open(path, "w") as f:
+            json.dump(changes, f)
+        return
+    with open(path, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(("time", "actuator", "duty"))
+        rows = sorted((t, name, d) for name, events in changes.items() for t, d in events)
+        writer.writerows(rows)
+
+
+def minmax(data, bins):
+    """Decimate data into bins of minimum and maximum values."""
+    size = max(1, -(-len(data) // bins))
+    padded = np.pad(data, (0, -len(data) % size), mode="edge").reshape(-1, size)
+    return padded.min(axis=1), padded.max(axis=1), size
+
+
+def plot_preview(dac, rate, times=None, duties=None, path=None):
+    """Plot decimated DAC output envelope and actuator duties, saving to path or showing."""
+    import matplotlib
+    if path:
+        matplotlib.use("Agg")
+    import matplotlib.pyplot as plt
+
+    low, high, size = minmax(dac, plot_bins)
+    x = np.arange(len(low)) * size / rate
+    rows = 1 if times is None else 2
+    fig, axes = plt.subplots(rows, 1, sharex=True, figsize=(12, 3 * rows), squeeze=False)
+    axes[0][0].fill_between(x, low, high, step="post", linewidth=0)
+    axes[0][0].set_ylabel("DAC")
+    if times is not None:
+        for i, name in enumerate(mech_names):
+            axes[1][0].step(times, duties[:, i] / 255 + 1.2 * i, where="post", label=name)
+        axes[1][0].set_yticks([1.2 * i for i in range(len(mech_names))], mech_names)
+    axes[-1][0].set_xlabel("Time (s)")
+    fig.tight_layout()
+    if path:
+        fig.savefig(path)
+        plt.close(fig)
+    else:
+        plt.show()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a ULV file into the DAC output and actuator timeline.")
+    parser.add_argument("ulv_file", help="ULV file to decode")
+    parser.add_argument("--wav", help="output WAV file (default: ULV file name with .decoded.wav)")
+    parser.add_argument("--timeline", help="output actuator timeline, .csv or .json (default: .csv next to WAV)")
+    parser.add_argument("--plot", nargs="?", const="", metavar="PNG",
+                        help="plot DAC envelope and actuators, saved to PNG if given, otherwise shown")
+    args = parser.parse_args()
+
+    start = time.perf_counter()
+    buf = ulv.open_ulv(args.ulv_file)
+    try:
+        header = ulv.read_header(buf)
+    except ulv.UlvError as e:
+        print(f"Invalid file: {e}")
+        return 1
+
+    offsets, samples, problems = ulv.read_frames(buf, header)
+    for problem in problems:
+        print(f"Warning: {problem}")
+    dac = ulv.dac_output(header, ulv.read_audio(buf, header, offsets))
+    mech, pwm = ulv.read_mech(buf, header, offsets)
+    times, duties = ulv.mech_timeline(header, offsets, samples, mech, pwm)
+
+    base = os.path.splitext(args.ulv_file)[0]
+    wav_path = args.wav or base + ".decoded.wav"  # Not the source audio next to the song
+    timeline_path = args.timeline or os.path.splitext(wav_path)[0] + ".csv"
+    wavfile.write(wav_path, header.rate, dac)  # 8-bit WAV is unsigned like the DAC
+    write_timeline(timeline_path, timeline_changes(times, duties))
+
+    seconds = len(dac) / header.rate
+    elapsed = time.perf_counter() - start
+    print(f"Decoded {seconds:.2f} s at {header.rate} Hz to '{wav_path}' and '{timeline_path}' "
+          f"in {elapsed:.2f} s ({seconds / max(elapsed, 1e-6):.0f}x real time)")
+
+    if args.plot is not None:
+        plot_preview(dac, header.rate, times, duties, args.plot or None)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
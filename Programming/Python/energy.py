@@ -0,0 +1,53 @@
+import numpy as np
+
+# Estimated currents of Uolevi Rev 1.1 at 4.5 V in amperes, see the README
+actuator_currents = np.array([0.4, 0.9, 0.02, 0.02])  # LEGS, MOUTH, LEFT EYE, RIGHT EYE
+speaker_current = 0.04
+load_current = 0.04
+load_bytes_per_s = 16777216 / 365  # 16 MB loads in approx. 6 min 5 s
+
+
+def mech_duties(mech_bytes, pwm_duties=None):
+    """Expand mech bytes into 2 samples of actuator duties (0-1) each, optionally scaled by PWM duty bytes."""
+    mech_bytes = np.asarray(mech_bytes, dtype=np.uint8)
+    nibbles = np.stack((mech_bytes & 0x0F, mech_bytes >> 4), axis=1).reshape(-1)
+    duties = ((nibbles[:, None] >> np.arange(4)) & 1).astype(float)
+    if pwm_duties is not None:
+        scale = np.repeat(np.asarray(pwm_duties, dtype=float) / 255, 2, axis=0)
+        duties[:, :scale.shape[1]] *= scale
+    return duties
+
+
+def logged_duties(clocks, values, start, end, clock_hz):
+    """Actuator duties (0-1) and durations in seconds of the spans between output changes logged at clocks, from
+    start to end, with actuators off before the first change."""
+    edges = np.concatenate(([start], np.clip(np.asarray(clocks, dtype=np.int64), start, end), [end]))
+    duties = np.concatenate((np.zeros((1, values.shape[1])), np.asarray(values, dtype=float) / 255))
+    return duties, np.diff(edges) / clock_hz
+
+
+def energy_report(duties, durations, file_bytes, current_limit):
+    """Integrate current over mech samples with given durations in seconds into charge per play and load."""
+    currents = speaker_current + duties @ actuator_currents
+    peak = int(np.argmax(currents))
+    load_seconds = file_bytes / load_bytes_per_s
+
+    return {
+        "play_seconds": float(np.sum(durations)),
+        "play_mah": float(np.dot(currents, durations)) / 3.6,
+        "load_seconds": load_seconds,
+        "load_mah": load_current * load_seconds / 3.6,
+        "peak_current": float(currents[peak]),
+        "peak_time": float(np.sum(durations[:peak])),
+        "over_limit_seconds": float(np.sum(durations[currents > current_limit])),
+        "current_limit": current_limit,
+    }
+
+
+def print_energy_report(report, indent=""):
+    print(f"{indent}Energy per play: {report['play_mah']:.2f} mAh over {report['play_seconds']:.1f} s")
+    print(f"{indent}Energy per load: {report['load_mah']:.2f} mAh over {report['load_seconds']:.1f} s")
+    print(f"{indent}Peak current: {report['peak_current']:.2f} A at {report['peak_time']:.2f} s")
+    if report["over_limit_seconds"] > 0:
+        print(f"{indent}Warning: current exceeds {report['current_limit']:g} A limit for "
+              f"{report['over_limit_seconds']:.2f} s!")
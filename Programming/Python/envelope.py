@@ -0,0 +1,60 @@
+import numpy as np
+
+gate_ratio = 0.1  # Quietest envelope that can open, relative to the loud end of the song
+
+
+def envelope(samples, rate, window):
+    """RMS envelope of samples in the range -1 to 1 over windows of given seconds."""
+    n = max(1, round(window * rate))
+    count = -(-len(samples) // n)
+    frames = np.pad(samples, (0, count * n - len(samples))).reshape(count, n)
+    return np.sqrt(np.mean(np.square(frames, dtype=np.float32), axis=1))
+
+
+def hysteresis(env, on_level, off_level):
+    """Switch on above on_level and off below off_level, holding the state in between."""
+    marks = np.where(env > on_level, 1, np.where(env < off_level, -1, 0))
+    last = np.where(marks != 0, np.arange(len(marks)), 0)
+    np.maximum.accumulate(last, out=last)
+    return marks[last] > 0
+
+
+def enforce_minimums(state, min_on, min_off):
+    """Merge runs shorter than min_on windows on or min_off windows off into the run before them."""
+    state = state.copy()
+    edges = np.flatnonzero(np.diff(state.astype(np.int8))) + 1
+    starts = np.concatenate(([0], edges))
+    ends = np.concatenate((edges, [len(state)]))
+    current = state[0] if len(state) else False
+    for start, end in zip(starts, ends):
+        value = state[start]
+        if start and value != current and end - start < (min_on if value else min_off):
+            state[start:end] = current  # Too short, keep previous state
+        else:
+            current = value
+    return state
+
+
+def toggle_times(state, window):
+    """Toggle times in seconds of a state sequence starting off."""
+    changes = np.flatnonzero(np.diff(np.concatenate(([0], state.astype(np.int8)))))
+    return list(changes * window)
+
+
+def envelope_toggles(samples, rate, window, on_ratio, off_ratio, min_on, min_off, average=0):
+    """Toggle times following the loudness of samples.
+
+    Levels are relative to the moving average envelope over average seconds, which follows syllables, or to the
+    loud end of the whole song when average is 0. Envelopes below the gate stay off.
+    """
+    env = envelope(samples, rate, window)
+    if not len(env):
+        return []
+    reference = np.percentile(env, 95)
+    if average:
+        n = max(1, round(average / window))
+        reference = np.convolve(env, np.ones(n) / n, "same")
+    gate = gate_ratio * np.percentile(env, 95)
+    state = hysteresis(env, np.maximum(on_ratio * reference, gate), np.maximum(off_ratio * reference, gate))
+    state = enforce_minimums(state, round(min_on / window), round(min_off / window))
+    return toggle_times(state, window)
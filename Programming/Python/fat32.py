@@ -0,0 +1,220 @@
+import math
+import os
+import struct
+from dataclasses import dataclass, field
+
+import numpy as np
+
+sector_bytes = 512
+partition_start = 8192  # First partition and data area aligned to 4 MB like SD card factory formats
+align_sectors = 8192
+min_clusters = 65525  # Petit FatFs mounts smaller volumes as FAT16
+end_of_chain = 0x0FFFFFFF
+volume_label = b"UOLEVI     "
+
+
+@dataclass
+class FatFile:
+    name: str
+    size: int
+    first_cluster: int
+    clusters: list = field(default_factory=list)
+
+    def extents(self):
+        """Runs of consecutive clusters as (first cluster, cluster count)."""
+        runs = []
+        for c in self.clusters:
+            if runs and runs[-1][0] + runs[-1][1] == c:
+                runs[-1][1] += 1
+            else:
+                runs.append([c, 1])
+        return [tuple(r) for r in runs]
+
+
+@dataclass
+class FatVolume:
+    start: int  # Partition start sector
+    cluster_sectors: int
+    fat_start: int  # Sectors from start of image
+    fat_sectors: int
+    data_start: int
+    clusters: int
+    root_cluster: int
+    fat: np.ndarray
+    files: list
+
+    @property
+    def cluster_bytes(self):
+        return self.cluster_sectors * sector_bytes
+
+    def cluster_sector(self, cluster):
+        """First sector of a data cluster from start of image."""
+        return self.data_start + (cluster - 2) * self.cluster_sectors
+
+
+def short_name(name):
+    """8.3 directory entry name of a file name."""
+    base, _, ext = name.upper().partition(".")
+    if not base or len(base) > 8 or len(ext) > 3:
+        raise ValueError(f"'{name}' is not an 8.3 file name")
+    return (base.ljust(8) + ext.ljust(3)).encode("ascii")
+
+
+def allocate(sizes, cluster_bytes, interleave=0):
+    """Cluster chains of files after the root directory cluster.
+
+    Files are contiguous in order unless interleave is given, in which case runs of that many clusters
+    of each file alternate, fragmenting all files.
+    """
+    counts = [max(1, math.ceil(size / cluster_bytes)) for size in sizes]
+    chains = [[] for _ in sizes]
+    cluster = 3
+    if not interleave:
+        for i, count in enumerate(counts):
+            chains[i] = list(range(cluster, cluster + count))
+            cluster += count
+        return chains
+
+    while any(len(chains[i]) < counts[i] for i in range(len(sizes))):
+        for i, count in enumerate(counts):
+            run = min(interleave, count - len(chains[i]))
+            chains[i] += range(cluster, cluster + run)
+            cluster += run
+    return chains
+
+
+def build_image(path, files, cluster_bytes=32768, image_bytes=0, interleave=0):
+    """Write a partitioned FAT32 image holding (name, source path) files in the root directory."""
+    if cluster_bytes % sector_bytes or not 1 <= cluster_bytes // sector_bytes <= 128:
+        raise ValueError("cluster size must be 512 bytes to 64 kB")
+    cluster_sectors = cluster_bytes // sector_bytes
+    if len(files) + 1 > cluster_bytes // 32:
+        raise ValueError("too many files for one root directory cluster")
+
+    sizes = [os.path.getsize(source) for _, source in files]
+    chains = allocate(sizes, cluster_bytes, interleave)
+    used = max([1] + [max(chain) - 1 for chain in chains])
+
+    # Volume size from image size, at least enough clusters for the files and FAT32
+    clusters = max(min_clusters, used)
+    if image_bytes:
+        available = image_bytes // sector_bytes - partition_start - align_sectors
+        clusters = max(clusters, available // cluster_sectors - 1)
+    fat_sectors = math.ceil((clusters + 2) * 4 / sector_bytes)
+
+    # Reserve sectors so that the data area starts at an aligned sector
+    reserved = 32
+    data_start = partition_start + reserved + 2 * fat_sectors
+    reserved += -data_start % align_sectors
+    data_start = partition_start + reserved + 2 * fat_sectors
+    total_sectors = reserved + 2 * fat_sectors + clusters * cluster_sectors
+
+    # Boot sector
+    boot = bytearray(sector_bytes)
+    boot[0:3] = b"\xEB\x58\x90"
+    boot[3:11] = b"UOLEVI  "
+    struct.pack_into("<HBHBHHBHHHII", boot, 11, sector_bytes, cluster_sectors, reserved, 2, 0, 0, 0xF8, 0,
+                     63, 255, partition_start, total_sectors)
+    struct.pack_into("<IHHIHH", boot, 36, fat_sectors, 0, 0, 2, 1, 6)
+    struct.pack_into("<BBBI11s8s", boot, 64, 0x80, 0, 0x29, 0x55AA0001, volume_label, b"FAT32   ")
+    boot[510:512] = b"\x55\xAA"
+
+    # File system information sector
+    free = clusters - used
+    info = bytearray(sector_bytes)
+    struct.pack_into("<I", info, 0, 0x41615252)
+    struct.pack_into("<III", info, 484, 0x61417272, free, used + 2)
+    struct.pack_into("<I", info, 508, 0xAA550000)
+
+    # Master boot record with one FAT32 LBA partition
+    mbr = bytearray(sector_bytes)
+    struct.pack_into("<B3sB3sII", mbr, 446, 0, b"\xFE\xFF\xFF", 0x0C, b"\xFE\xFF\xFF",
+                     partition_start, total_sectors)
+    mbr[510:512] = b"\x55\xAA"
+
+    fat = np.zeros(clusters + 2, dtype="<u4")
+    fat[0:3] = (0x0FFFFFF8, end_of_chain, end_of_chain)
+    for chain in chains:
+        fat[chain[:-1]] = chain[1:]
+        fat[chain[-1]] = end_of_chain
+
+    root = bytearray(cluster_bytes)
+    root[0:11] = volume_label
+    root[11] = 0x08
+    for i, ((name, _), size, chain) in enumerate(zip(files, sizes, chains)):
+        struct.pack_into("<11sBBBHHHHHHHI", root, 32 * (i + 1), short_name(name), 0x20, 0, 0, 0, 0, 0,
+                         chain[0] >> 16, 0, 0, chain[0] & 0xFFFF, size)
+
+    with open(path, "wb") as f:
+        f.truncate((partition_start + total_sectors) * sector_bytes)  # Sparse where possible
+        f.write(mbr)
+        for sector, data in ((0, boot), (1, info), (6, boot), (7, info)):
+            f.seek((partition_start + sector) * sector_bytes)
+            f.write(data)
+        for copy in range(2):
+            f.seek((partition_start + reserved + copy * fat_sectors) * sector_bytes)
+            f.write(fat.tobytes())
+        f.seek(data_start * sector_bytes)
+        f.write(root)
+
+        for (_, source), chain in zip(files, chains):
+            with open(source, "rb") as src:
+                for first, count in FatFile("", 0, 0, chain).extents():
+                    f.seek((data_start + (first - 2) * cluster_sectors) * sector_bytes)
+                    f.write(src.read(count * cluster_bytes))
+
+    return chains
+
+
+def read_volume(path):
+    """Read the FAT32 volume of an image or device and the cluster chains of its root directory files."""
+    with open(path, "rb") as f:
+        sector = f.read(sector_bytes)
+        start = 0
+        if sector[82:87] != b"FAT32":
+            if sector[510:512] != b"\x55\xAA" or not sector[450]:
+                raise ValueError("no FAT32 boot record or partition")
+            start = struct.unpack_from("<I", sector, 454)[0]
+            f.seek(start * sector_bytes)
+            sector = f.read(sector_bytes)
+            if sector[82:87] != b"FAT32":
+                raise ValueError("first partition is not FAT32")
+
+        cluster_sectors, reserved, fats = struct.unpack_from("<BHB", sector, 13)
+        total_sectors = struct.unpack_from("<I", sector, 32)[0]
+        fat_sectors, _, _, root_cluster = struct.unpack_from("<IHHI", sector, 36)
+        fat_start = start + reserved
+        data_start = fat_start + fats * fat_sectors
+        clusters = (total_sectors - reserved - fats * fat_sectors) // cluster_sectors
+
+        f.seek(fat_start * sector_bytes)
+        fat = np.frombuffer(f.read(fat_sectors * sector_bytes), dtype="<u4") & 0x0FFFFFFF
+        volume = FatVolume(start, cluster_sectors, fat_start, fat_sectors, data_start, clusters, root_cluster,
+                           fat, [])
+
+        def chain(cluster):
+            clusters = []
+            while 2 <= cluster < len(fat) and len(clusters) <= volume.clusters:
+                clusters.append(int(cluster))
+                cluster = fat[cluster]
+            return clusters
+
+        directory = bytearray()
+        for cluster in chain(root_cluster):
+            f.seek(volume.cluster_sector(cluster) * sector_bytes)
+            directory += f.read(volume.cluster_bytes)
+
+    for pos in range(0, len(directory), 32):
+        entry = directory[pos:pos + 32]
+        if entry[0] == 0:
+            break
+        if entry[0] == 0xE5 or entry[11] & 0x0E:  # Deleted, volume label, system or long name entry
+            continue
+        hi, lo, size = struct.unpack_from("<H4xHI", entry, 20)
+        name = entry[0:8].decode("ascii", "replace").rstrip()
+        ext = entry[8:11].decode("ascii", "replace").rstrip()
+        first = hi << 16 | lo
+        clusters = chain(first)[:max(1, math.ceil(size / volume.cluster_bytes))] if first else []
+        volume.files.append(FatFile(name + ("." + ext if ext else ""), size, first, clusters))
+
+    return volume
@@ -0,0 +1,232 @@
+import argparse
+import ctypes
+import os
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+import firmware
+import ulv
+from energy import logged_duties, energy_report, print_energy_report
+
+merge_clocks = 500  # Actuator outputs written by one play_mech are one change
+tick_ms = 0.0256  # Timer clock period of timer.h
+ramp = np.arange(0xFE, 0x7F, -1)  # DAC writes of the start-up ramp of startup() before the first sample
+
+
+def intended_output(header, audio):
+    """Encoder's intended linear samples with 8 fractional bits, one per sample clock."""
+    if header.flags & ulv.ulv_rle:
+        escape = audio == 0
+        count = np.zeros(len(audio), dtype=bool)
+        count[1:] = escape[:-1]
+        keep = ~count
+        codes = audio[keep]
+        lengths = np.where(escape[keep], np.concatenate((audio[1:], [0]))[keep], 1).astype(np.int64)
+    else:
+        codes = audio
+        lengths = np.ones(len(audio), dtype=np.int64)
+
+    values = ulv.mulaw_table()[codes] if header.flags & ulv.ulv_mulaw else codes.astype(np.int64) << 8
+
+    # Runs repeat the previous sample
+    plain = lengths == 1 if not header.flags & ulv.ulv_rle else codes != 0
+    last = np.where(plain, np.arange(len(codes)), -1)
+    np.maximum.accumulate(last, out=last)
+    values = np.where(last >= 0, values[np.maximum(last, 0)], 0x8000)
+
+    if header.flags & ulv.ulv_half_rate:
+        previous = np.concatenate(([0x8000], values[:-1]))
+        # A run holds the previous sample, which ends the interpolation
+        mid = np.where(plain, (previous >> 1) + (values >> 1), values)
+        values = np.stack((mid, values), axis=1).reshape(-1)
+        lengths = np.stack((np.where(plain, 1, lengths), np.where(plain, 1, lengths)), axis=1).reshape(-1)
+    return np.repeat(values, lengths)
+
+
+def jitter_histogram(jitter, period):
+    edges = [-np.inf, -period, -10, -2, 3, 11, period, 2 * period, np.inf]
+    counts, _ = np.histogram(jitter, edges)
+    labels = [f"< {-period}", f"{-period} to -11", "-10 to -3", "-2 to 2", "3 to 10", f"11 to {period - 1}",
+              f"{period} to {2 * period - 1}", f">= {2 * period}"]
+    return [(label, int(count)) for label, count in zip(labels, counts) if count]
+
+
+def play(library, data):
+    """Run startup() and play() of the host firmware on flash memory holding data, returning the result and the clocks
+    play() started."""
+    library.reset()
+    library.erase()
+    library.memory[:len(data)] = np.frombuffer(data, dtype=np.uint8)
+    result = library.run("startup")
+    if result:
+        raise RuntimeError(f"startup() returned {result}")
+    library.clear_logs()
+
+    seconds = len(data) * 2 / 4000 + 10  # Longer than any song at the lowest rate
+    start = library.clock
+    return library.run("play", clocks=int(seconds * firmware.f_cpu)), start
+
+
+def actuator_changes(clocks, duties, end):
+    """Actuator outputs at play_mech calls, merging the outputs written by one call and leaving out those after end."""
+    keep = clocks <= end
+    clocks, duties = clocks[keep].astype(np.int64), duties[keep].astype(np.int64)
+    if not len(clocks):
+        return clocks, duties
+    last = np.concatenate((np.diff(clocks) > merge_clocks, [True]))
+    first = np.concatenate(([True], last[:-1]))
+    clocks, duties = clocks[first], duties[last]
+    changed = np.any(duties != np.concatenate((np.zeros((1, duties.shape[1]), dtype=np.int64), duties[:-1])), axis=1)
+    return clocks[changed], duties[changed]
+
+
+def check(path, library, max_jitter, max_mech_error, max_ttfs, current_limit):
+    """Play a ULV file with the firmware and compare it to the encoder's intent, returning the number of failures."""
+    print(f"{path}:")
+    buf = ulv.open_ulv(path)
+    try:
+        header = ulv.read_header(buf)
+    except ulv.UlvError as e:
+        print(f"  INVALID: {e}")
+        return 1
+
+    offsets, samples, problems = ulv.read_frames(buf, header)
+    for problem in problems:
+        print(f"  Warning: {problem}")
+    audio = ulv.read_audio(buf, header, offsets)
+    intended = intended_output(header, audio)
+    mech, pwm = ulv.read_mech(buf, header, offsets)
+    mech_times, mech_duties = ulv.mech_timeline(header, offsets, samples, mech, pwm)
+
+    start = time.perf_counter()
+    result, begin = play(library, bytes(buf[:4 + header.size]))
+    elapsed = time.perf_counter() - start
+    end = library.clock
+    if result:
+        print(f"  FAIL: play() returned {result}")
+        return 1
+
+    failures = 0
+    ttfs = library.variable(ctypes.c_uint32, "ttfs_ticks").value * tick_ms
+    print(f"  Time to first sample: {ttfs:.2f} ms from reset")
+    if ttfs > max_ttfs:
+        print(f"  FAIL: time to first sample exceeds {max_ttfs} ms")
+        failures += 1
+
+    times, values = library.log("host_dac")
+    times = times.astype(np.int64)
+    values = values[:, 0].astype(np.int64)
+    if not np.array_equal(values[:len(ramp)], ramp):
+        print("  FAIL: DAC does not ramp to center value before the first sample")
+        return failures + 1
+    times, values = times[len(ramp):], values[len(ramp):]
+
+    # Sample clock slot of every DAC write, the first write is at slot 0
+    ideal = firmware.f_cpu / header.rate
+    period = firmware.f_cpu // header.rate
+    t0 = times[0] if len(times) else begin
+    written = np.round((times - t0) / ideal).astype(np.int64)
+    slots = int((end - t0) // ideal) + 1 if len(times) else 0
+    seconds = slots / header.rate
+
+    # Clock rate from DAC write times, effective rate from intended samples over playing time
+    if len(times) > 1:
+        slope = np.polyfit(written.astype(float), times.astype(float), 1)[0]
+        clock_rate = firmware.f_cpu / slope
+        effective = firmware.f_cpu * (len(intended) - 1) / max(times[-1] - times[0], 1)
+        print(f"  Sample rate {header.rate} Hz, clock {clock_rate:.2f} Hz ({(clock_rate / header.rate - 1) * 1e6:+.1f} ppm),"
+              f" effective {effective:.2f} Hz ({(effective / header.rate - 1) * 1e6:+.1f} ppm)")
+
+    # Jitter of DAC writes against the ideal sample grid, constant latency removed
+    if len(times):
+        deviation = times - (t0 + np.round(written * ideal).astype(np.int64))
+        jitter = deviation - int(np.median(deviation))
+        worst = int(np.max(np.abs(jitter)))
+        print(f"  Jitter in CPU clocks (period {ideal:.1f}), worst {worst}:")
+        for label, count in jitter_histogram(jitter, period):
+            print(f"    {label:>12}: {count}")
+        if worst > max_jitter:
+            print(f"  FAIL: jitter {worst} clocks exceeds {max_jitter}")
+            failures += 1
+
+    # DAC level at every sample clock, held between writes, against intended samples
+    duplicated = len(written) - len(np.unique(written))
+    output = np.zeros(slots, dtype=np.int64)
+    held = np.full(slots, -1, dtype=np.int64)
+    held[written[written < slots]] = np.nonzero(written < slots)[0]
+    np.maximum.accumulate(held, out=held)
+    output[held >= 0] = values[held[held >= 0]]
+    common = min(slots, len(intended))
+    mismatched = int(np.sum(np.abs(output[:common] * 256 - intended[:common]) >= 256))
+    dropped = max(len(intended) - slots, 0)
+    extra = max(slots - len(intended), 0)
+    print(f"  Samples: {len(intended)} intended, {len(written)} written, {slots - len(np.unique(written))} held in "
+          f"runs, {duplicated} duplicated, {dropped} dropped, {extra} extra, {mismatched} wrong by more than 1 LSB")
+    if duplicated or dropped or extra or mismatched:
+        print("  FAIL: DAC output differs from intended samples")
+        failures += 1
+
+    # Actuator changes against the first sample of their mech sample
+    changed = np.any(mech_duties != np.concatenate((np.zeros((1, mech_duties.shape[1]), dtype=mech_duties.dtype),
+                                                    mech_duties[:-1])), axis=1)
+    mech_times, mech_duties = mech_times[changed], mech_duties[changed]
+    clocks, duties = actuator_changes(*library.log("host_actuators"), times[-1] if len(times) else end)
+    if len(clocks) != len(mech_times) or np.any(duties != mech_duties):
+        print(f"  FAIL: {len(clocks)} actuator changes, {len(mech_times)} intended or duties differ")
+        failures += 1
+    elif len(clocks):
+        error = (clocks - t0) / firmware.f_cpu - mech_times
+        print(f"  Actuator timing: {len(clocks)} changes, error mean {np.mean(error) * 1e6:+.1f} us,"
+              f" range {np.min(error) * 1e6:+.1f} to {np.max(error) * 1e6:+.1f} us")
+        if np.max(np.abs(error)) * 1e3 > max_mech_error:
+            print(f"  FAIL: actuator timing error exceeds {max_mech_error} ms")
+            failures += 1
+
+    # Battery use of the actuator outputs driven by the firmware
+    duties, durations = logged_duties(*library.log("host_actuators"), t0, end, firmware.f_cpu)
+    print_energy_report(energy_report(duties, durations, 4 + header.size, current_limit), "  ")
+
+    print(f"  Played {seconds:.2f} s in {elapsed:.2f} s")
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Play ULV files with play() of the firmware built for the host and "
+                                                 "compare the DAC and actuator output to the encoder's intent.")
+    parser.add_argument("paths", nargs="+", help="ULV files")
+    parser.add_argument("--cost", action="append", default=[], metavar="NAME=CLOCKS",
+                        help="override the estimated CPU clocks of host.c, one of "
+                             f"{', '.join(name for name, _ in firmware.Costs._fields_)}")
+    parser.add_argument("--max-jitter", type=int, default=50,
+                        help="largest allowed DAC write jitter in CPU clocks, timer interrupts delay writes by about "
+                             "35 (default 50)")
+    parser.add_argument("--max-mech-error", type=float, default=0.1,
+                        help="largest allowed actuator timing error in milliseconds (default 0.1)")
+    parser.add_argument("--current-limit", type=float, default=1.0,
+                        help="peak current in A to warn about in the energy report (default 1.0)")
+    parser.add_argument("--max-ttfs", type=float, default=10,
+                        help="largest allowed time from reset to the first sample in milliseconds, the DAC ramp takes "
+                             "6.5 (default 10)")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as directory:
+        library = firmware.build(os.path.join(directory, "firmware.so"))
+        for item in args.cost:
+            name, _, value = item.partition("=")
+            if name not in dict(firmware.Costs._fields_):
+                parser.error(f"unknown cost '{name}'")
+            setattr(library.costs, name, int(value))
+
+        failures = 0
+        for path in args.paths:
+            failures += check(path, library, args.max_jitter, args.max_mech_error, args.max_ttfs,
+                              args.current_limit) > 0
+    print(f"\n{len(args.paths)} files, {failures} failed")
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
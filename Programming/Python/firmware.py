@@ -0,0 +1,108 @@
+import ctypes
+import glob
+import os
+import subprocess
+
+import numpy as np
+
+# Host build of the firmware sources over the peripherals of Firmware/host, timed in CPU clocks
+
+directory = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "Firmware")
+f_cpu = 10000000
+memory_size = 0x1000000
+
+# host_run results besides the return value of the function
+asleep = -1
+timeout = -2
+
+select_function = ctypes.CFUNCTYPE(None, ctypes.c_uint64, ctypes.c_uint8)
+transfer_function = ctypes.CFUNCTYPE(ctypes.c_uint8, ctypes.c_uint64, ctypes.c_uint8)
+
+
+class Device(ctypes.Structure):
+    _fields_ = [("select", select_function), ("transfer", transfer_function)]
+
+
+class Costs(ctypes.Structure):
+    _fields_ = [("access", ctypes.c_uint32), ("interrupt", ctypes.c_uint32), ("wake", ctypes.c_uint32),
+                ("eeprom", ctypes.c_uint32)]
+
+
+class Log(ctypes.Structure):
+    _fields_ = [("count", ctypes.c_uint32), ("capacity", ctypes.c_uint32), ("width", ctypes.c_uint8),
+                ("clocks", ctypes.POINTER(ctypes.c_uint64)), ("values", ctypes.POINTER(ctypes.c_uint8))]
+
+
+def build(path, trace=False, sources=("host/memory.c",)):
+    """Compile the firmware with host peripherals and the given host sources into a shared library at path."""
+    files = glob.glob(os.path.join(directory, "source", "*.c")) + glob.glob(os.path.join(directory, "petitfs", "*.c"))
+    files += [os.path.join(directory, "host", "host.c")] + [os.path.join(directory, s) for s in sources]
+    # Variables defined in main.h are common symbols shared by the files including it
+    command = [os.environ.get("CC", "cc"), "-shared", "-fPIC", "-O2", "-std=gnu99", "-fcommon"]
+    command += ["-DSPI_TRACE"] if trace else []
+    command += ["-I" + os.path.join(directory, d) for d in ("host", "header", "petitfs", "")]
+    command += ["-o", path] + files
+    subprocess.run(command, check=True)
+    return Firmware(path)
+
+
+class Firmware:
+    """Shared library of build(), running firmware functions until they return or the CPU stops."""
+
+    def __init__(self, path):
+        self.library = ctypes.CDLL(path)
+        self.library.host_run.argtypes = (ctypes.c_void_p,)
+        self.library.host_run.restype = ctypes.c_int16
+        self.library.host_call.argtypes = (ctypes.c_void_p, ctypes.c_uint8)
+        self.library.host_call.restype = ctypes.c_int16
+        self.library.host_log_clear.argtypes = (ctypes.POINTER(Log),)
+        self.costs = Costs.in_dll(self.library, "host_costs")
+        self.devices = (Device * 2).in_dll(self.library, "host_devices")
+        self.memory = np.ctypeslib.as_array((ctypes.c_uint8 * memory_size).in_dll(self.library, "host_memory"))
+        self.callbacks = [None, None]
+
+    def variable(self, ctype, name):
+        return ctype.in_dll(self.library, name)
+
+    @property
+    def clock(self):
+        return self.variable(ctypes.c_uint64, "host_clock").value
+
+    @property
+    def conflicts(self):
+        return self.variable(ctypes.c_uint32, "host_conflicts").value
+
+    def reset(self):
+        """Reset the peripherals and CPU clock, the flash device is the memory of memory.c."""
+        self.library.host_reset()
+        self.callbacks = [None, None]
+
+    def erase(self):
+        self.library.host_memory_erase()
+
+    def run(self, name, argument=None, clocks=None):
+        """Run a firmware function with no or one uint8_t argument, stopping with timeout after clocks CPU clocks."""
+        limit = self.variable(ctypes.c_uint64, "host_limit")
+        limit.value = self.clock + clocks if clocks is not None else 2 ** 64 - 1
+        function = ctypes.cast(getattr(self.library, name), ctypes.c_void_p)
+        if argument is None:
+            return self.library.host_run(function)
+        return self.library.host_call(function, argument)
+
+    def attach(self, device, select, transfer):
+        """Attach Python SPI device functions to a chip select, 0 for flash and 1 for SD card."""
+        self.callbacks[device] = (select_function(select), transfer_function(transfer))
+        self.devices[device] = Device(*self.callbacks[device])
+
+    def log(self, name):
+        """CPU clocks and values of a host log, host_dac or host_actuators."""
+        log = Log.in_dll(self.library, name)
+        if not log.count:
+            return np.zeros(0, dtype=np.uint64), np.zeros((0, log.width), dtype=np.uint8)
+        clocks = np.ctypeslib.as_array(log.clocks, (log.count,)).copy()
+        values = np.ctypeslib.as_array(log.values, (log.count * log.width,)).reshape(-1, log.width).copy()
+        return clocks, values
+
+    def clear_logs(self):
+        for name in ("host_dac", "host_actuators"):
+            self.library.host_log_clear(ctypes.byref(Log.in_dll(self.library, name)))
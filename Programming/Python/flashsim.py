@@ -0,0 +1,410 @@
+import argparse
+import ctypes
+import os
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+import fat32
+import firmware
+import sdcount
+import ulv
+
+flash_bytes = 16777216
+page_bytes = 256
+sector_bytes = 4096
+jedec_id = (0xEF, 0x40)  # Winbond, W25Q..JV, followed by log2 of the capacity, 0x18 for the W25Q128JV
+timer_hz = firmware.f_cpu / 256  # Firmware timer ticks of trace records
+
+# W25Q128JV datasheet timings in seconds, typical and maximum
+timings = {
+    "page_program": (0.0004, 0.003),  # tPP
+    "sector_erase": (0.045, 0.4),  # tSE, 4 kB
+    "block_erase_32": (0.12, 1.6),  # tBE1, 32 kB
+    "block_erase": (0.15, 2.0),  # tBE2, 64 kB
+    "chip_erase": (40.0, 200.0),  # tCE
+    "suspend": (0.00002, 0.00002),  # tSUS
+    "release": (0.000003, 0.000003),  # tRES1
+    "power_down": (0.000003, 0.000003),  # tDP
+}
+erases = {0x20: ("sector_erase", 4096), 0x52: ("block_erase_32", 32768), 0xD8: ("block_erase", 65536),
+          0xC7: ("chip_erase", 0), 0x60: ("chip_erase", 0)}  # Chip erase covers the whole capacity
+addressed = (0x02, 0x03, 0x20, 0x52, 0xD8)  # Commands with 3 or, in 4-byte address mode, 4 address bytes
+
+
+def sfdp_table(size):
+    """Serial flash discoverable parameters: header, one parameter header and the basic table at 0x80 with the
+    density of size bytes, 4, 32 and 64 kB erase commands and 256-byte pages."""
+    sfdp = bytearray(b"SFDP\x06\x01\x00\xff\x00\x06\x01\x10\x80\x00\x00\xff").ljust(0x80, b"\xff")
+    sfdp += (bytes((0xE5, 0x20, 0xF9, 0xFF)) + (size * 8 - 1).to_bytes(4, "little")).ljust(28, b"\xff")
+    sfdp += bytes((0x0C, 0x20, 0x0F, 0x52, 0x10, 0xD8, 0x00, 0xFF)).ljust(12, b"\xff")
+    sfdp += bytes((0x89,)) + b"\xff" * 23
+    return sfdp
+
+
+class W25Q128:
+    """SPI flash model of the W25Q128 driven a byte at a time, with datasheet busy times.
+
+    Time is advanced by the caller. Commands that the chip ignores, such as writes without write enable or commands
+    while busy or powered down, are counted in violations. Larger sizes model the W25Q256 and up, which also take
+    4-byte addresses after 0xB7 until 0xE9, the W25Q128 rejects both.
+    """
+
+    def __init__(self, worst=False, size=flash_bytes):
+        self.size = size
+        self.sfdp = sfdp_table(size)
+        self.memory = np.full(size, 0xFF, dtype=np.uint8)
+        self.erase_counts = np.zeros(size // sector_bytes, dtype=np.int64)
+        self.four_byte = False
+        self.worst = worst
+        self.time = 0.0
+        self.busy_until = 0.0
+        self.busy_time = 0.0  # Total time spent programming and erasing
+        self.operation = None  # Name of running program or erase, completed when busy ends
+        self.suspended = None  # Remaining time of suspended erase
+        self.wel = False
+        self.powered_down = False
+        self.violations = {}
+        self.commands = {}
+        self.programmed = 0
+        self.selected = False
+        self.bytes = []
+
+    def violation(self, reason):
+        self.violations[reason] = self.violations.get(reason, 0) + 1
+
+    @property
+    def busy(self):
+        self.update()
+        return self.time < self.busy_until
+
+    def update(self):
+        """Finish an operation whose busy time has passed."""
+        if self.operation and self.time >= self.busy_until:
+            self.operation = None
+            self.wel = False
+
+    def start(self, name):
+        """Start a program or erase, its contents change at once as reads are refused until busy ends."""
+        duration = timings[name][self.worst]
+        self.busy_until = self.time + duration
+        self.busy_time += duration
+        self.operation = name
+
+    def advance(self, seconds):
+        self.time += seconds
+        self.update()
+
+    def status(self, register):
+        if register == 0x05:
+            return (1 if self.busy else 0) | (2 if self.wel else 0)
+        return 0x80 if self.suspended is not None else 0  # SUS bit of status register 2
+
+    def select(self):
+        self.selected = True
+        self.bytes = []
+
+    @property
+    def address_bytes(self):
+        return 4 if self.four_byte else 3
+
+    def address(self, count):
+        """Address of count bytes after the command byte."""
+        return int.from_bytes(bytes(self.bytes[1:1 + count]), "big")
+
+    def transfer(self, value):
+        """Clock a byte in, returning the byte clocked out."""
+        self.bytes.append(value)
+        command = self.bytes[0]
+        n = len(self.bytes)
+        if n == 1:
+            return 0xFF
+        if command in (0x05, 0x35):
+            return self.status(command)
+        if command == 0x03 and n > 1 + self.address_bytes and not self.busy and not self.powered_down:
+            address = self.address(self.address_bytes) + n - 2 - self.address_bytes
+            return int(self.memory[address % self.size])
+        if command == 0x9F and 2 <= n <= 4:
+            return (jedec_id + (self.size.bit_length() - 1,))[n - 2]
+        if command == 0x5A and n > 5:  # Always 3 address bytes and a dummy byte
+            address = self.address(3) + n - 6
+            return self.sfdp[address] if address < len(self.sfdp) else 0xFF
+        return 0xFF
+
+    def write(self, data):
+        """Clock in many bytes whose output is ignored, such as page program data."""
+        self.bytes.extend(data)
+
+    def deselect(self):
+        """End a command, executing it like the chip does on chip select going high."""
+        self.selected = False
+        if not self.bytes:
+            return
+        command = self.bytes[0]
+        self.commands[command] = self.commands.get(command, 0) + 1
+
+        if self.powered_down and command != 0xAB:
+            self.violation("command while powered down")
+            return
+        if command in (0x05, 0x35, 0x03, 0x9F, 0x5A):
+            if command in (0x03, 0x9F, 0x5A) and self.busy:
+                self.violation("read while busy")
+            return
+        if command == 0xAB:
+            self.powered_down = False
+            self.advance(timings["release"][0])
+            return
+        if command == 0x75:  # Erase suspend
+            if self.busy and self.operation != "page_program" and self.suspended is None:
+                self.suspended = self.busy_until - self.time
+                self.busy_time -= self.suspended
+                self.busy_until = self.time + timings["suspend"][0]
+                self.operation = None
+            return
+        if command == 0x7A:  # Erase resume
+            if self.suspended is not None:
+                self.busy_until = self.time + self.suspended
+                self.busy_time += self.suspended
+                self.suspended = None
+                self.operation = "resumed_erase"
+            return
+        if self.busy:
+            self.violation(f"command 0x{command:02X} while busy")
+            return
+        if command in (0xB7, 0xE9) and self.size > flash_bytes:  # Enter and exit 4-byte address mode
+            self.four_byte = command == 0xB7
+        elif command == 0xB9:
+            self.powered_down = True
+            self.advance(timings["power_down"][0])
+        elif command == 0x06:
+            self.wel = True
+        elif command == 0x04:
+            self.wel = False
+        elif command == 0x02 or command in erases:
+            if not self.wel:
+                self.violation(f"command 0x{command:02X} without write enable")
+                return
+            if self.suspended is not None:
+                self.violation(f"command 0x{command:02X} while erase is suspended")
+                return
+            count = self.address_bytes if command in addressed else 0
+            if len(self.bytes) < 1 + count:
+                self.violation(f"command 0x{command:02X} without address")
+                return
+            address = self.address(count) % self.size
+            if command == 0x02:
+                self.program(address, self.bytes[1 + count:])
+            else:
+                self.erase(command, address)
+        else:
+            self.violation(f"unknown command 0x{command:02X}")
+
+    def program(self, address, data):
+        if not data:
+            return
+        # Address wraps to the start of the page, only the last 256 bytes are kept
+        if len(data) > page_bytes:
+            self.violation("page program wrapped")
+        base = address & ~(page_bytes - 1)
+        offset = (address + max(0, len(data) - page_bytes)) % page_bytes
+        data = np.frombuffer(bytes(data[-page_bytes:]), dtype=np.uint8)
+        index = base + (offset + np.arange(len(data))) % page_bytes
+        if np.any(~self.memory[index] & data):
+            self.violation("programmed bits that were not erased")
+
+        self.memory[index] &= data
+        self.programmed += len(data)
+        self.start("page_program")
+
+    def erase(self, command, address):
+        name, size = erases[command]
+        size = size or self.size
+        start = address & ~(size - 1)
+        self.memory[start:start + size] = 0xFF
+        self.erase_counts[start // sector_bytes:(start + size) // sector_bytes] += 1
+        self.start(name)
+
+
+class Bus:
+    """Flash model attached as the flash device of a host firmware build, advanced with the CPU clock.
+
+    Adds up the CPU clocks of runs of status polls and of other flash transactions.
+    """
+
+    def __init__(self, library, flash):
+        self.flash = flash
+        self.clocks = {"flash_wait": 0, "flash_spi": 0}
+        self.start = 0  # Clock at select
+        self.polling = None  # Clock at select of the first status poll of a run
+        self.polled = 0  # Clock at deselect of the last status poll
+        library.attach(0, self.select, self.transfer)
+
+    def advance(self, clock):
+        seconds = clock / firmware.f_cpu
+        if seconds > self.flash.time:
+            self.flash.advance(seconds - self.flash.time)
+
+    def finish(self):
+        """End a run of status polls."""
+        if self.polling is not None:
+            self.clocks["flash_wait"] += self.polled - self.polling
+            self.polling = None
+
+    def select(self, clock, selected):
+        self.advance(clock)
+        if selected:
+            self.flash.select()
+            self.start = clock
+            return
+
+        command = self.flash.bytes[0] if self.flash.bytes else None
+        self.flash.deselect()
+        if command == 0x05:
+            if self.polling is None:
+                self.polling = self.start
+            self.polled = clock
+        else:
+            self.finish()
+            self.clocks["flash_spi"] += clock - self.start
+
+    def transfer(self, clock, value):
+        self.advance(clock)
+        return self.flash.transfer(value)
+
+
+def suspend_check(library, worst, size):
+    """Start a 64 kB erase with the firmware's flash_erase(), play a 50 ms song from another block with play(),
+    which suspends the erase to read and resumes it, and wait for the erase with flash_wait().
+
+    Returns the flash model and the seconds the erase was suspended and took in total, with problems as violations.
+    """
+    flash = W25Q128(worst, size)
+    library.reset()
+    Bus(library, flash)
+    samples = np.arange(ulv.ulv_frame, dtype=np.int64) % 255 + 1
+    song = np.concatenate((np.frombuffer(np.uint32(1 + ulv.ulv_frame).tobytes(), dtype=np.uint8), [0x0F],
+                           samples)).astype(np.uint8)
+    flash.memory[:len(song)] = song
+    block = size // 2
+    flash.memory[block:block + 65536] = 0  # Erased contents tell the erase ran
+
+    if library.run("startup"):
+        flash.violation("suspend check: startup() failed")
+        return flash, 0.0, 0.0
+    library.clear_logs()
+    library.library.flash_erase.argtypes = (ctypes.c_uint32,)
+    library.library.flash_erase(block)
+    library.library.host_sync()  # Chip select goes high at the next access
+    erase_start = flash.time
+    if flash.operation != "block_erase":
+        flash.violation("suspend check: flash_erase() did not start a 64 kB erase")
+
+    result = library.run("play", clocks=firmware.f_cpu)
+    suspended = flash.time - erase_start
+    if result:
+        flash.violation(f"suspend check: play() returned {result}")
+    if not flash.commands.get(0x75) or not flash.commands.get(0x7A):
+        flash.violation("suspend check: play() did not suspend and resume the erase")
+    _, values = library.log("host_dac")
+    if not np.array_equal(values[-len(samples):, 0], samples):
+        flash.violation("suspend check: play() read wrong samples during suspended erase")
+
+    result = library.run("flash_wait", clocks=10 * firmware.f_cpu)
+    if result or flash.busy or flash.suspended is not None:
+        flash.violation("suspend check: erase did not complete after resume")
+    if np.any(flash.memory[block:block + 65536] != 0xFF) or flash.erase_counts[block // sector_bytes] != 1:
+        flash.violation("suspend check: block was not erased")
+    return flash, suspended, flash.time - erase_start
+
+
+def heatmap(counts, columns=16):
+    """Erase counts of 64 kB blocks as rows of characters, . for none and 1-9 or + for more."""
+    blocks = counts.reshape(-1, 65536 // sector_bytes).max(axis=1)
+    chars = np.array(list(".123456789+"))[np.minimum(blocks, 10)]
+    return ["".join(chars[i:i + columns]) for i in range(0, len(chars), columns)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate loading ULV files into the W25Q128 flash memory with "
+                                                 "datasheet timings, running the firmware's read_file() compiled "
+                                                 "for the host, and report busy time and erase counts.")
+    parser.add_argument("paths", nargs="+", help="ULV files loaded one after another")
+    parser.add_argument("--worst", action="store_true", help="use maximum instead of typical datasheet timings")
+    parser.add_argument("--cluster-kb", type=int, default=32, help="SD card cluster size in kB (default 32)")
+    parser.add_argument("--repeat", type=int, default=1, help="load the files this many times (default 1)")
+    parser.add_argument("--flash-mb", type=int, default=16,
+                        help="flash memory size in MB, a power of two, above 16 the firmware uses 4-byte addresses "
+                             "(default 16)")
+    args = parser.parse_args()
+    if args.flash_mb < 1 or args.flash_mb & (args.flash_mb - 1):
+        parser.error("flash memory size must be a power of two")
+    size = args.flash_mb << 20
+
+    start = time.perf_counter()
+    flash = W25Q128(args.worst, size)
+    with tempfile.TemporaryDirectory() as directory:
+        library = sdcount.build(directory)
+        image = os.path.join(directory, "card.img")
+        fat32.build_image(image, [(f"{i}.ULV", path) for i, path in enumerate(args.paths)], args.cluster_kb * 1024)
+
+        library.reset()
+        bus = Bus(library, flash)
+        if library.library.sdcard_open(image.encode(), sdcount.access_bytes):
+            raise OSError(f"cannot open '{image}'")
+        try:
+            if library.run("startup"):
+                raise RuntimeError("startup() failed")
+            for _ in range(args.repeat):
+                for i, path in enumerate(args.paths):
+                    data = np.fromfile(path, dtype=np.uint8)
+                    data = data[:4 + ulv.read_header(data).size]
+
+                    sd = sdcount.Counters()
+                    spi = dict(bus.clocks)
+                    begin = library.clock
+                    library.variable(ctypes.c_uint8, "file_num").value = i + 1
+                    library.library.sdcard_count(sd)
+                    result = library.run("read_file", clocks=1000 * firmware.f_cpu)
+                    library.library.sdcard_count(None)
+                    bus.finish()
+                    if result:
+                        flash.violation(f"read_file() returned {result}")
+                        continue
+                    if not np.array_equal(flash.memory[:len(data)], data):
+                        flash.violation("flash differs from file after load")
+
+                    clocks = library.clock - begin
+                    times = {"flash_wait": bus.clocks["flash_wait"] - spi["flash_wait"], "sd": sd.clocks,
+                             "flash_spi": bus.clocks["flash_spi"] - spi["flash_spi"]}
+                    times["other"] = clocks - sum(times.values())
+                    print(f"{os.path.basename(path)}: {len(data)} bytes loaded in {clocks / firmware.f_cpu:.1f} s")
+                    for name, label in (("flash_wait", "waiting on flash"), ("sd", "reading SD card"),
+                                        ("flash_spi", "sending to flash"), ("other", "beeps, CPU and EEPROM")):
+                        print(f"  {label:>21}: {times[name] / firmware.f_cpu:7.1f} s "
+                              f"({times[name] / clocks * 100:4.1f} %)")
+        finally:
+            library.library.sdcard_close()
+
+        # Erase suspend and resume of play() during an erase
+        check, suspended, erase = suspend_check(library, args.worst, size)
+        print(f"\nErase suspended {suspended * 1000:.1f} ms for play(), completed {erase * 1000:.1f} ms after start "
+              f"(0x75 {check.commands.get(0x75, 0)}, 0x7A {check.commands.get(0x7A, 0)})")
+        for reason, count in check.violations.items():
+            flash.violation(reason)
+
+    print(f"\nFlash busy {flash.busy_time:.1f} s, {flash.programmed} bytes programmed, "
+          f"{int(np.sum(flash.erase_counts))} sector erases, at most {int(np.max(flash.erase_counts))} per sector")
+    print("Commands: " + ", ".join(f"0x{c:02X} {n}" for c, n in sorted(flash.commands.items())))
+    print("Erases per 64 kB block, 1 MB per row:")
+    for row in heatmap(flash.erase_counts):
+        print("  " + row)
+    for reason, count in flash.violations.items():
+        print(f"VIOLATION: {reason} ({count}x)")
+    print(f"Simulated in {time.perf_counter() - start:.1f} s")
+    return 1 if flash.violations else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,96 @@
+import argparse
+import os
+import sys
+import time
+
+import numpy as np
+
+import ulv
+from energy import load_bytes_per_s, mech_duties, energy_report
+
+flash_bytes = 16777216
+mech_names = ("legs", "mouth", "left eye", "right eye")
+
+
+def inspect(path, flash_size):
+    """Validate a ULV file and print its summary, returning the number of problems."""
+    buf = ulv.open_ulv(path)
+    print(f"{path}:")
+    try:
+        header = ulv.read_header(buf)
+    except ulv.UlvError as e:
+        print(f"  INVALID: {e}")
+        return 1
+
+    problems = []
+    if 4 + header.size > len(buf):
+        problems.append(f"truncated, header N gives {4 + header.size} bytes but file has {len(buf)}")
+    elif 4 + header.size < len(buf):
+        problems.append(f"{len(buf) - 4 - header.size} bytes after the data counted by N")
+    if 4 + header.size > flash_size:
+        problems.append(f"{4 + header.size} bytes do not fit in {flash_size}-byte flash")
+    unknown = header.flags & ~sum(ulv.flag_names)
+    if unknown:
+        problems.append(f"unknown flags 0x{unknown:02X}")
+    if header.flags & ulv.ulv_paged and header.data_offset != 256:
+        problems.append(f"paged file has first frame at {header.data_offset} instead of 256")
+    if header.flags & ulv.ulv_paged and header.mech_length + header.frame != 256:
+        problems.append(f"paged file has {header.mech_length + header.frame}-byte frames")
+
+    offsets, samples, frame_problems = ulv.read_frames(buf, header)
+    problems += frame_problems
+
+    flags = ", ".join(name for flag, name in ulv.flag_names.items() if header.flags & flag) or "none"
+    seconds = ulv.duration(header, samples)
+    print(f"  ULV {header.version}, {header.rate} Hz, F {header.frame}, flags {flags}")
+    print(f"  Duration {int(seconds // 60)} min {seconds % 60:.2f} s in {len(offsets)} frames")
+    print(f"  Flash {4 + header.size} bytes ({100 * (4 + header.size) / flash_size:.1f} %), "
+          f"{ulv.flash_blocks(header)} blocks of 64 kB, "
+          f"load approx. {1000 * (4 + header.size) / load_bytes_per_s:.0f} ms")
+
+    if len(offsets):
+        mech, pwm = ulv.read_mech(buf, header, offsets)
+        duties = mech_duties(mech, pwm)
+        states = duties > 0
+        toggles = np.count_nonzero(np.diff(states, axis=0), axis=0) + states[0]
+        for i, name in enumerate(mech_names):
+            print(f"  Mech {name}: on {100 * np.mean(states[:, i]):.1f} %, "
+                  f"mean duty {100 * np.mean(duties[:, i]):.1f} %, {toggles[i]} toggles")
+
+        # Mech samples cover alternating halves of frames
+        halves = np.array(((header.frame + 1) // 2, header.frame // 2)) / header.stored_rate
+        report = energy_report(duties, np.tile(halves, len(mech)), 4 + header.size, 1.0)
+        print(f"  Energy {report['play_mah']:.2f} mAh per play, peak {report['peak_current']:.2f} A")
+
+    for problem in problems:
+        print(f"  INVALID: {problem}")
+    return len(problems)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Validate ULV files and print their contents.")
+    parser.add_argument("paths", nargs="+", help="ULV files or directories, e.g. the root of an SD card")
+    parser.add_argument("--flash-bytes", type=int, default=flash_bytes,
+                        help=f"external flash capacity in bytes (default {flash_bytes})")
+    args = parser.parse_args()
+
+    files = []
+    for path in args.paths:
+        if os.path.isdir(path):
+            files += sorted(os.path.join(path, f) for f in os.listdir(path) if f.lower().endswith(".ulv"))
+        else:
+            files.append(path)
+
+    start = time.perf_counter()
+    invalid = 0
+    for path in files:
+        if inspect(path, args.flash_bytes):
+            invalid += 1
+    print()
+    print(f"{len(files)} files, {invalid} invalid, inspected in {1000 * (time.perf_counter() - start):.0f} ms")
+
+    return 1 if invalid else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
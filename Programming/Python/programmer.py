@@ -1,25 +1,177 @@
+import argparse
 import math
 import struct
 import numpy as np
-import matplotlib.pyplot as plt
-from scipy.io import wavfile
-import scipy.signal as sps
 
-# Max song length 9 min 21 s (Loading time approx. 6 min 5 s)
+import audio
+import ulv
+from cache import BuildCache
+from decoder import plot_preview
+from energy import mech_duties, energy_report, print_energy_report
+from envelope import envelope_toggles
+
+# Max song length 9 min 21 s with W25Q128 (Loading time approx. 6 min 5 s)
 flash_bytes = 16777216
 sample_rate = 29840
 mech_rate = 40
 
-# LEGS, MOUTH, LEFT EYE, RIGHT EYE
-mech_toggles = []
+# ULV 1.1 extended header
+ulv_extended = 0x80000000
+ulv_header_length = 6
+ulv_half_rate = 0x01
+ulv_rle = 0x02
+ulv_mulaw = 0x04
+ulv_paged = 0x08
+ulv_pwm = 0x10
+pwm_channels = 3  # Legs, mouth and left eye, the right eye pin has no PWM output
+page_bytes = 256
+rle_min_run = 4  # Shorter runs are cheaper as plain samples
+encoder_version = 3  # Increase when the output for the same inputs changes, invalidating cached files
+
+
+def mulaw_encode(data):
+    """Compand 16-bit linear samples to G.711 mu-law codes."""
+    data = data.astype(np.int32)
+    sign = np.where(data < 0, 0x80, 0)
+    magnitude = np.minimum(np.abs(data), 32635) + 0x84
+    exponent = np.floor(np.log2(magnitude >> 7)).astype(np.int32)
+    mantissa = (magnitude >> (exponent + 3)) & 0x0F
+    return (~(sign | (exponent << 4) | mantissa) & 0xFF).astype(np.uint8)
+
+
+def encode_runs(samples):
+    """Replace runs of equal samples with the previous sample and a 0x00, count escape."""
+    edges = np.flatnonzero(np.diff(samples)) + 1
+    starts = np.concatenate(([0], edges))
+    lengths = np.diff(np.concatenate((starts, [len(samples)])))
+
+    encoded = bytearray()
+    pos = 0
+    for run in np.flatnonzero(lengths >= rle_min_run):
+        start, length = starts[run], lengths[run]
+        encoded += samples[pos:start + 1].tobytes()
+        remaining = length - 1
+        while remaining > 0:
+            count = min(remaining, 255)
+            encoded += bytes((0, count))
+            remaining -= count
+        pos = start + length
+    encoded += samples[pos:].tobytes()
+
+    return encoded
+
+
+def quantise(args, audio_file, stored_rate):
+    """Decode, downmix, resample and quantise an audio file block by block into stored audio samples."""
+    rate, blocks = audio.read_blocks(audio_file)
+
+    # Resampling also removes content above the stored Nyquist frequency
+    quantised = []
+    for block in audio.resample_blocks(blocks, rate, stored_rate):
+        if args.mulaw:
+            block = mulaw_encode(np.round(np.interp(block, (-1.0, 1.0), (-32768, 32767))))
+        else:
+            block = np.round(np.interp(block, (-1.0, 1.0), (0, 255))).astype(np.uint8)
+        if args.rle:
+            block = np.maximum(block, 1)  # 0 is the run escape
+        quantised.append(block)
+
+    return np.concatenate(quantised) if quantised else np.zeros(0, dtype=np.uint8)
 
 
 def main():
-    programming_file = "../Songs/" + input("Programming text file: ")
+    global sample_rate, flash_bytes
+
+    parser = argparse.ArgumentParser(description="Program songs into ULV files.")
+    parser.add_argument("programming_files", nargs="*", help="programming text files in the Songs directory")
+    parser.add_argument("--rate", type=int, default=sample_rate,
+                        help=f"sample rate in Hz, e.g. 11025 or 16000 for speech (default {sample_rate})")
+    parser.add_argument("--half-rate", action="store_true",
+                        help="store audio at half the sample rate, interpolated back by the firmware")
+    parser.add_argument("--rle", action="store_true",
+                        help="run-length encode spans of constant samples such as silence")
+    parser.add_argument("--mulaw", action="store_true",
+                        help="store mu-law companded audio, expanded by the firmware")
+    parser.add_argument("--flash-bytes", type=int, default=flash_bytes,
+                        help=f"external flash capacity in bytes (default {flash_bytes})")
+    parser.add_argument("--paged", action="store_true",
+                        help="align frames of 1 mech byte and 255 audio samples to flash pages")
+    parser.add_argument("--pwm", action="store_true",
+                        help="store PWM duties for legs, mouth and left eye with every mech byte")
+    parser.add_argument("--duty", type=int, nargs=pwm_channels, default=[255] * pwm_channels,
+                        metavar=("LEGS", "MOUTH", "LEFT_EYE"), help="PWM duty when on, 0-255 (default 255)")
+    parser.add_argument("--soft-start", type=float, nargs=pwm_channels, default=[0.2, 0.0, 0.2],
+                        metavar=("LEGS", "MOUTH", "LEFT_EYE"),
+                        help="seconds to ramp PWM duty up after switching on, which cuts the starting current but "
+                             "keeps an actuator from reaching full duty when it is on for less time, so the mouth "
+                             "that opens for 60-100 ms has none (default 0.2 0 0.2)")
+    parser.add_argument("--current-limit", type=float, default=1.0,
+                        help="peak current in A to warn about in the energy report (default 1.0)")
+    parser.add_argument("--auto-mouth", action="store_true",
+                        help="generate mouth toggles from the audio envelope instead of the programming file")
+    parser.add_argument("--mouth-min", type=float, nargs=2, default=[0.075, 0.075], metavar=("ON", "OFF"),
+                        help="shortest mouth open and closed times in seconds (default 0.075 0.075)")
+    parser.add_argument("--auto-eyes", action="store_true",
+                        help="generate eye LED toggles for loud passages instead of the programming file")
+    parser.add_argument("--cache", nargs="?", const="../Songs/.cache", metavar="DIR",
+                        help="reuse resampled audio and ULV files of unchanged inputs (default DIR ../Songs/.cache)")
+    parser.add_argument("--no-plot", action="store_true", help="do not plot the audio, e.g. for batch builds")
+    args = parser.parse_args()
+
+    if args.rate < 1000 or args.rate > sample_rate:
+        print(f"Sample rate must be between 1000 and {sample_rate} Hz!")
+        return
+    if args.pwm and args.soft_start[1] >= args.mouth_min[0]:
+        print(f"Warning: mouth soft start {args.soft_start[1]:g} s is not shorter than the shortest mouth open "
+              f"time, the mouth may not reach full duty!")
+    sample_rate = args.rate
+    flash_bytes = args.flash_bytes
+
+    cache = BuildCache(args.cache) if args.cache else None
+    for programming_file in args.programming_files or [input("Programming text file: ")]:
+        program(args, programming_file, cache)
+
+
+def program(args, programming_file, cache):
+    """Encode the song of a programming file into a ULV file."""
+    # Rate of stored audio samples
+    flags = 0
+    stored_rate = sample_rate
+    if args.half_rate:
+        flags |= ulv_half_rate
+        stored_rate = sample_rate / 2
+    if args.rle:
+        flags |= ulv_rle
+    if args.mulaw:
+        flags |= ulv_mulaw
+    duty_bytes = 0
+    if args.pwm:
+        if any(d < 0 or d > 255 for d in args.duty):
+            print("PWM duty must be between 0 and 255!")
+            return
+        flags |= ulv_pwm
+        duty_bytes = pwm_channels
+
+    # Stored audio samples per mech byte, holding 2 mech samples
+    header_length = ulv_header_length
+    frame_samples = 2 * round(stored_rate / mech_rate)
+    if args.paged:
+        if args.rle:
+            print("Paged frames cannot be run-length encoded!")
+            return
+        flags |= ulv_paged
+        header_length = page_bytes - 4  # Pad header to first page
+        frame_samples = page_bytes - 1 - duty_bytes
+    halves = ((frame_samples + 1) // 2, frame_samples // 2)
+
+    programming_file = "../Songs/" + programming_file
     in_file = ""
+    mech_toggles = []  # LEGS, MOUTH, LEFT EYE, RIGHT EYE
 
     try:
         with open(programming_file, "r") as f:
+            toggle_text = f.read()
+            f.seek(0)
             in_file = f.readline().rstrip()
 
             for i in range(4):
@@ -40,68 +192,117 @@ def main():
 
     print("Programming file read.")
 
-    sr, data = wavfile.read("../Songs/" + in_file)
-    if len(data.shape) > 1:
-        datatype = type(data[0][0])
-        data = np.average(data, axis=1)
-    else:
-        datatype = type(data[0])
+    out_file = in_file.split('.')[0] + '.ulv'
+    if cache:
+        wav_hash = cache.file_hash("../Songs/" + in_file)
+        audio_key = cache.key(encoder_version, wav_hash, stored_rate, args.mulaw, args.rle)
+        ulv_key = cache.key(encoder_version, audio_key, toggle_text, sample_rate, flags, header_length,
+                            frame_samples, args.duty, args.soft_start, args.auto_mouth, args.mouth_min,
+                            args.auto_eyes)
+        if cache.load_file(ulv_key, "../Songs/" + out_file):
+            print(f"File '{out_file}' is up to date.")
+            print()
+            return
 
-    # Resample data
-    number_of_samples = round(len(data) * float(sample_rate) / sr)
-    data = sps.resample(data, number_of_samples).astype(datatype)
+    data = cache.load_array(audio_key) if cache else None
+    if data is None:
+        data = quantise(args, "../Songs/" + in_file, stored_rate)
+        if cache:
+            cache.save_array(audio_key, data)
 
-    # Convert data to uint8_t
-    if np.issubdtype(datatype, np.floating):
-        datarange = (-1.0, 1.0)
-    else:
-        datarange = (np.iinfo((type(data[0]))).min, np.iinfo((type(data[0]))).max)
-    data = np.interp(data, datarange, (0, 255))
-    data = np.round(data).astype(np.uint8)
+    # Plot DAC levels, companded codes are expanded like the firmware does
+    if not args.no_plot:
+        plot_preview(ulv.mulaw_table()[data] / 256 if args.mulaw else data, stored_rate)
 
-    plt.plot(data)
-    plt.show()
+    # Toggles following loudness, mouth opens on syllables and eyes on loud passages
+    if args.auto_mouth or args.auto_eyes:
+        linear = ulv.mulaw_table()[data] if args.mulaw else data.astype(np.int64) << 8
+        linear = (linear.astype(np.float32) - 0x8000) / 0x8000
+        if args.auto_mouth:
+            mech_toggles[1] = envelope_toggles(linear, stored_rate, 1 / mech_rate, 1.1, 0.9,
+                                               *args.mouth_min, average=0.2)
+            print(f"Generated {len(mech_toggles[1])} mouth toggles.")
+        if args.auto_eyes:
+            mech_toggles[2] = envelope_toggles(linear, stored_rate, 0.2, 0.8, 0.6, 1.0, 1.0)
+            mech_toggles[3] = mech_toggles[2]
+            print(f"Generated {len(mech_toggles[2])} eye toggles.")
 
     t = 0.0
     mech_states = [0, 0, 0, 0]
     mech_is = [0, 0, 0, 0]
+    mech_on = [0.0, 0.0, 0.0, 0.0]  # Time each actuator last switched on
     mech_bytes = []
-    for i in range(math.ceil(len(data) * (mech_rate / sample_rate) / 2)):
+    pwm_duties = []
+    for i in range(math.ceil(len(data) / frame_samples)):
         for j in range(4):
             if len(mech_toggles[j]) > mech_is[j] and t >= mech_toggles[j][mech_is[j]]:
                 if mech_states[j] == 0:
                     mech_states[j] = 1
+                    mech_on[j] = mech_toggles[j][mech_is[j]]
                 else:
                     mech_states[j] = 0
                 mech_is[j] += 1
         mech_bytes.append((mech_states[3] << 3) | (mech_states[2] << 2) | (mech_states[1] << 1) | mech_states[0])
-        t += 1.0 / mech_rate
+        t += halves[0] / stored_rate
 
         for j in range(4):
             if len(mech_toggles[j]) > mech_is[j] and t >= mech_toggles[j][mech_is[j]]:
                 if mech_states[j] == 0:
                     mech_states[j] = 1
+                    mech_on[j] = mech_toggles[j][mech_is[j]]
                 else:
                     mech_states[j] = 0
                 mech_is[j] += 1
         mech_bytes[-1] |= (mech_states[3] << 7) | (mech_states[2] << 6) | (mech_states[1] << 5) | (mech_states[0] << 4)
-        t += 1.0 / mech_rate
+        t += halves[1] / stored_rate
+
+        # Ramp duty up over soft start time, reaching it by the end of the frame
+        duties = []
+        for j in range(pwm_channels):
+            ramp = 1.0
+            if args.soft_start[j] > 0:
+                ramp = min(1.0, (t - mech_on[j]) / args.soft_start[j])
+            duties.append(math.ceil(args.duty[j] * ramp))
+        pwm_duties.append(duties)
+
+    # Full rate frames are the frames of ULV 1.0
+    if stored_rate == ulv.ulv_rate and not args.paged:
+        assert frame_samples == ulv.ulv_frame, f"F {frame_samples} differs from ULV 1.0 F {ulv.ulv_frame}"
+        assert len(mech_bytes) == math.ceil(len(data) * (mech_rate / ulv.ulv_rate) / 2), \
+            "frame count differs from ULV 1.0"
 
-    data_bytes = len(data) + len(mech_bytes)
+    # Interleave mech bytes and audio, runs do not cross mech samples
+    frames = []
+    for mech_i in range(len(mech_bytes)):
+        frames.append(struct.pack("<B", mech_bytes[mech_i]))
+        if args.pwm:
+            frames.append(bytes(pwm_duties[mech_i]))
+        start = mech_i * frame_samples
+        for half in halves:
+            if args.rle:
+                frames.append(encode_runs(data[start:start + half]))
+            else:
+                frames.append(data[start:start + half].tobytes())
+            start += half
+    audio = b"".join(frames)
+
+    data_bytes = header_length + len(audio)
     if 4 + data_bytes > flash_bytes:
         print(f"Too many bytes to write! ({4 + data_bytes}/{flash_bytes})")
-    print(f"Writing {4 + data_bytes} bytes to file '{in_file.split('.')[0] + '.ulv'}' ...")
-
-    with open("../Songs/" + in_file.split('.')[0] + '.ulv', "wb") as f:
-        f.write(struct.pack("<I", data_bytes))  # Bytes
+    print(f"Writing {4 + data_bytes} bytes at {stored_rate:g} Hz to file '{out_file}' ...")
 
-        mech_i = 0
-        for i in range(len(data)):
-            if i % ((sample_rate / mech_rate) * 2) == 0:
-                f.write(struct.pack("<B", mech_bytes[mech_i]))
-                mech_i += 1
+    with open("../Songs/" + out_file, "wb") as f:
+        f.write(struct.pack("<I", ulv_extended | data_bytes))  # Bytes
+        f.write(struct.pack("<BBHH", header_length, flags, sample_rate, frame_samples))  # Extended header
+        f.write(bytes(header_length - ulv_header_length))
+        f.write(audio)
+    if cache:
+        cache.save_file(ulv_key, "../Songs/" + out_file)
 
-            f.write(struct.pack("<B", data[i]))
+    # Estimate battery use from actuator duty cycles
+    duties = mech_duties(mech_bytes, pwm_duties if args.pwm else None)
+    durations = np.tile(np.array(halves) / stored_rate, len(mech_bytes))
+    print_energy_report(energy_report(duties, durations, 4 + data_bytes, args.current_limit))
 
     print("Done!")
     print()
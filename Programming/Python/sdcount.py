@@ -0,0 +1,178 @@
+import argparse
+import ctypes
+import math
+import os
+import re
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+import fat32
+import firmware
+
+access_bytes = 50  # Clocks until the data token of a read, about 80 us at 5 MHz
+command_bytes = 1 + 6 + 1 + 1 + 514  # Per CMD17 besides access: select clock, command, R1, token, sector and CRC
+init_commands = 5  # CMD0, CMD8, CMD55 and ACMD41, CMD58
+
+# Budgets of mounting, MBR and boot sector checks and BPB, and of opening song n, one read per directory entry
+mount_reads = 6
+open_reads = 1  # Plus n
+
+
+class Counters(ctypes.Structure):
+    _fields_ = [("commands", ctypes.c_uint32), ("cmd17", ctypes.c_uint32), ("boot_reads", ctypes.c_uint32),
+                ("fat_reads", ctypes.c_uint32), ("data_reads", ctypes.c_uint32), ("bytes", ctypes.c_uint64),
+                ("start", ctypes.c_uint64), ("end", ctypes.c_uint64), ("clocks", ctypes.c_uint64)]
+
+    def add(self, other):
+        for name in ("commands", "cmd17", "boot_reads", "fat_reads", "data_reads", "bytes", "clocks"):
+            setattr(self, name, getattr(self, name) + getattr(other, name))
+
+
+def build(directory, trace=False):
+    """Compile the firmware with the host flash memory and SD card into a shared library."""
+    library = firmware.build(os.path.join(directory, "sdcard.so"), trace, ("host/memory.c", "host/sdcard.c"))
+    library.library.sdcard_open.argtypes = (ctypes.c_char_p, ctypes.c_uint16)
+    library.library.sdcard_count.argtypes = (ctypes.POINTER(Counters),)
+    return library
+
+
+def buffer_size():
+    """BUFFER_SIZE of read_file() in main.c."""
+    with open(os.path.join(firmware.directory, "source", "main.c")) as f:
+        return int(re.search(r"#define BUFFER_SIZE (\d+)", f.read()).group(1))
+
+
+def budget(size, cluster_bytes):
+    """Largest allowed reads, FAT reads and bytes clocked loading a file of size bytes and unmounting.
+
+    Every sector is read once and every cluster after the first costs one FAT read, wherever the cluster is.
+    """
+    clusters = math.ceil(size / cluster_bytes)
+    fat_reads = clusters - 1
+    reads = math.ceil(size / 512) + fat_reads + mount_reads
+    return reads, fat_reads, reads * (command_bytes + access_bytes)
+
+
+def fragments(sizes, cluster_bytes, interleave):
+    """Fragments of files laid out by fat32.build_image, each after the first needs at least one FAT read."""
+    chains = fat32.allocate(sizes, cluster_bytes, interleave)
+    return [1 + int(np.count_nonzero(np.diff(chain) != 1)) for chain in chains]
+
+
+def run(library, directory, cluster_kb, interleave, songs, song_bytes):
+    """Mount, open and load every song of an image with the given cluster size and clusters per fragment.
+
+    Returns counters of the phases, CPU clocks from first to last SD card byte of loading and budget failures.
+    """
+    image = os.path.join(directory, "card.img")
+    files = [(f"{i}.ULV", os.path.join(directory, f"{i}.ulv")) for i in range(songs)]
+    fat32.build_image(image, files, cluster_kb * 1024, interleave=interleave)
+
+    mount, opened, loaded = Counters(), Counters(), Counters()
+    clocks = 0
+    failures = []
+    library.reset()
+    library.erase()
+    if library.library.sdcard_open(image.encode(), access_bytes):
+        raise OSError(f"cannot open '{image}'")
+    try:
+        result = library.run("startup")
+        if result:
+            raise RuntimeError(f"startup() returned {result}")
+
+        for i, (_, path) in enumerate(files):
+            # Phases of read_file() with the SD card unmounted after the previous song
+            library.variable(ctypes.c_uint8, "file_num").value = i + 1
+            for counters, name, argument in ((mount, "init_sd_card", None), (opened, "open_file", i + 1),
+                                             (loaded, "read_file", None)):
+                phase = Counters()
+                library.library.sdcard_count(phase)
+                result = library.run(name, argument, clocks=100 * firmware.f_cpu)
+                library.library.sdcard_count(None)
+                counters.add(phase)
+                if counters is loaded:
+                    clocks += phase.end - phase.start
+                if result:
+                    failures.append(f"{name}() of song {i + 1} returned {result}")
+                    break
+            else:
+                data = np.fromfile(path, dtype=np.uint8)
+                wrong = np.count_nonzero(library.memory[:len(data)] != data)
+                if wrong:
+                    failures.append(f"song {i + 1} has {wrong} wrong bytes in flash")
+    finally:
+        library.library.sdcard_close()
+    os.remove(image)
+
+    reads, fat_reads, clocked = (songs * b for b in budget(song_bytes, cluster_kb * 1024))
+    if mount.cmd17 > songs * mount_reads:
+        failures.append(f"mounting took {mount.cmd17} reads, budget {songs * mount_reads}")
+    if mount.commands > songs * (mount_reads + init_commands):
+        failures.append(f"mounting took {mount.commands} commands, budget {songs * (mount_reads + init_commands)}")
+    open_budget = songs * open_reads + songs * (songs + 1) // 2
+    if opened.cmd17 > open_budget:
+        failures.append(f"opening took {opened.cmd17} reads, budget {open_budget}")
+    if loaded.cmd17 > reads:
+        failures.append(f"loading took {loaded.cmd17} reads, budget {reads}")
+    if loaded.fat_reads > fat_reads:
+        failures.append(f"loading took {loaded.fat_reads} FAT reads, budget {fat_reads}")
+    jumps = sum(fragments([song_bytes] * songs, cluster_kb * 1024, interleave)) - songs
+    if loaded.fat_reads < jumps:
+        failures.append(f"loading took {loaded.fat_reads} FAT reads for {jumps} jumps between fragments")
+    if loaded.bytes > clocked:
+        failures.append(f"loading clocked {loaded.bytes} bytes, budget {clocked}")
+    return mount, opened, loaded, clocks, failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Count SD card commands of loading songs from FAT32 images with "
+                                                 "different cluster sizes and fragmentation, running the firmware's "
+                                                 "init_sd_card(), open_file() and read_file() compiled for the host "
+                                                 "over an emulated SD card, and check them against budgets.")
+    parser.add_argument("--cluster-kb", type=int, nargs="+", default=[4, 8, 16, 32, 64],
+                        help="cluster sizes in kB (default 4 8 16 32 64)")
+    parser.add_argument("--interleave", type=int, nargs="+", default=[0, 1, 8],
+                        help="clusters per fragment of the songs, which alternate, 0 for contiguous songs "
+                             "(default 0 1 8)")
+    parser.add_argument("--songs", type=int, default=3, help="songs on each image (default 3)")
+    parser.add_argument("--song-kb", type=int, default=2000, help="size of each song in kB (default 2000)")
+    args = parser.parse_args()
+
+    start = time.perf_counter()
+    song_bytes = args.song_kb * 1024 - 123  # Not a whole number of sectors
+    failed = 0
+    with tempfile.TemporaryDirectory() as directory:
+        library = build(directory)
+        rng = np.random.default_rng(0)
+        for i in range(args.songs):
+            # Valid size header, the rest is random
+            data = rng.integers(0, 256, song_bytes, dtype=np.uint8)
+            data[:4] = np.frombuffer((song_bytes - 4).to_bytes(4, "little"), dtype=np.uint8)
+            data.tofile(os.path.join(directory, f"{i}.ulv"))
+
+        print(f"{args.songs} songs of {song_bytes} bytes, read in {buffer_size()}-byte blocks")
+        print(f"{'cluster':>8} {'layout':>12} {'CMD17':>8} {'FAT':>6} {'FAT/MB':>7} {'clocked/B':>10} {'s/MB':>6}  "
+              f"mount+open")
+        for cluster_kb in args.cluster_kb:
+            for interleave in args.interleave:
+                mount, opened, loaded, clocks, failures = run(library, directory, cluster_kb, interleave, args.songs,
+                                                              song_bytes)
+                megabytes = args.songs * song_bytes / 1048576
+                layout = f"{interleave} clusters" if interleave else "contiguous"
+                print(f"{cluster_kb:>6}kB {layout:>12} {loaded.cmd17:>8} {loaded.fat_reads:>6} "
+                      f"{loaded.fat_reads / megabytes:>7.1f} {loaded.bytes / (args.songs * song_bytes):>10.4f} "
+                      f"{clocks / firmware.f_cpu / megabytes:>6.2f}  {mount.commands}+{opened.commands} commands")
+                for failure in failures:
+                    print(f"  FAIL: {failure}")
+                failed += bool(failures)
+
+    print(f"\n{len(args.cluster_kb) * len(args.interleave)} layouts, {failed} over budget in "
+          f"{time.perf_counter() - start:.1f} s")
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
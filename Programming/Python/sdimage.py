@@ -0,0 +1,112 @@
+import argparse
+import os
+import re
+import shutil
+import sys
+
+import fat32
+import ulv
+
+max_songs = 10
+
+
+def song_name(index):
+    """File name the firmware opens for song number index + 1."""
+    return f"{index}.ULV"
+
+
+def report(volume):
+    """Print layout of songs on a volume, returning the number of fragmented songs."""
+    fragmented = 0
+    print(f"Clusters of {volume.cluster_bytes // 1024} kB, data area at sector {volume.data_start}")
+    songs = sorted((f for f in volume.files if re.fullmatch(r"\d\.ULV", f.name)), key=lambda f: f.name)
+    previous_end = None
+    for f in songs:
+        extents = f.extents()
+        status = "contiguous" if len(extents) == 1 else f"FRAGMENTED into {len(extents)} extents"
+        if len(extents) > 1:
+            fragmented += 1
+        gap = ""
+        if previous_end is not None and extents and extents[0][0] != previous_end:
+            gap = f", {extents[0][0] - previous_end:+d} clusters from previous song"
+        print(f"  {f.name}: {f.size} bytes from cluster {f.first_cluster}, {status}{gap}")
+        if extents:
+            previous_end = extents[-1][0] + extents[-1][1]
+    if not songs:
+        print("  No songs")
+    return fragmented
+
+
+def copy_to_card(songs, directory):
+    """Replace songs in a mounted card directory, writing each file in one go in play order."""
+    for name in os.listdir(directory):
+        if re.fullmatch(r"\d\.ulv", name, re.IGNORECASE):
+            os.remove(os.path.join(directory, name))
+
+    for i, source in enumerate(songs):
+        target = os.path.join(directory, song_name(i))
+        with open(source, "rb") as src, open(target, "wb") as dst:
+            size = os.fstat(src.fileno()).st_size
+            try:
+                os.posix_fallocate(dst.fileno(), 0, size)  # Ask for one extent up front
+            except (AttributeError, OSError):
+                pass
+            shutil.copyfileobj(src, dst, 1 << 20)
+            dst.flush()
+            os.fsync(dst.fileno())
+        print(f"Copied '{source}' to '{target}'")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Place ULV songs on an SD card image or card in play order.")
+    parser.add_argument("songs", nargs="*", help="ULV files in play order, at most 10")
+    parser.add_argument("--list", help="text file with one ULV file per line, in play order")
+    parser.add_argument("-o", "--image", help="FAT32 image file to build")
+    parser.add_argument("--cluster-kb", type=int, default=32, help="cluster size of the image in kB (default 32)")
+    parser.add_argument("--size-mb", type=int, default=0, help="image size in MB (default: as small as FAT32 allows)")
+    parser.add_argument("--mount", help="directory of a mounted card to copy songs to")
+    parser.add_argument("--device", help="image, device or partition to check for fragmentation, "
+                                         "e.g. the device of the card given with --mount")
+    args = parser.parse_args()
+
+    songs = list(args.songs)
+    if args.list:
+        with open(args.list, "r") as f:
+            songs += [line.strip() for line in f if line.strip()]
+    if len(songs) > max_songs:
+        print(f"At most {max_songs} songs can be selected on Uolevi!")
+        return 1
+
+    for song in songs:
+        try:
+            ulv.read_header(ulv.open_ulv(song))
+        except (OSError, ulv.UlvError) as e:
+            print(f"'{song}' is not a valid ULV file: {e}")
+            return 1
+
+    if args.image:
+        files = [(song_name(i), song) for i, song in enumerate(songs)]
+        fat32.build_image(args.image, files, args.cluster_kb * 1024, args.size_mb * 1024 * 1024)
+        print(f"Built '{args.image}' with {len(songs)} songs")
+    if args.mount:
+        copy_to_card(songs, args.mount)
+
+    check = args.device or args.image
+    if not check:
+        if args.mount:
+            print("Give the card's device with --device to check for fragmentation.")
+        return 0
+
+    try:
+        volume = fat32.read_volume(check)
+    except (OSError, ValueError) as e:
+        print(f"Cannot read '{check}': {e}")
+        return 1
+    fragmented = report(volume)
+    if fragmented:
+        print(f"{fragmented} songs are fragmented, reformat the card and copy the songs again.")
+    return 1 if fragmented else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
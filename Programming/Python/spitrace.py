@@ -0,0 +1,287 @@
+import argparse
+import ctypes
+import difflib
+import os
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+import fat32
+import firmware
+import flashsim
+import sdcount
+import ulv
+
+# Records of trace.h, written one after another to trace files
+record_dtype = np.dtype([("time", "<u4"), ("address", "<u4"), ("length", "<u2"), ("device", "u1"), ("command", "u1")])
+ring_records = 16  # TRACE_RECORDS
+device_names = ("flash", "sd")
+
+flash_commands = {0x02: "page program", 0x03: "read", 0x04: "write disable", 0x05: "read status 1",
+                  0x06: "write enable", 0x20: "4 kB erase", 0x35: "read status 2", 0x52: "32 kB erase",
+                  0x5A: "read SFDP", 0x60: "chip erase", 0x75: "erase suspend", 0x7A: "erase resume",
+                  0x9F: "JEDEC ID", 0xAB: "release power-down", 0xB7: "4-byte addresses", 0xB9: "power-down",
+                  0xC7: "chip erase", 0xD8: "64 kB erase"}
+sd_commands = {0: "GO_IDLE_STATE", 1: "SEND_OP_COND", 8: "SEND_IF_COND", 16: "SET_BLOCKLEN",
+               17: "READ_SINGLE_BLOCK", 18: "READ_MULTIPLE_BLOCK", 24: "WRITE_BLOCK", 41: "SD_SEND_OP_COND",
+               55: "APP_CMD", 58: "READ_OCR"}
+
+
+class TraceRecord(ctypes.Structure):
+    _fields_ = [("time", ctypes.c_uint32), ("address", ctypes.c_uint32), ("length", ctypes.c_uint16),
+                ("device", ctypes.c_uint8), ("command", ctypes.c_uint8)]
+
+
+def command_name(device, command):
+    if device == 0:
+        return flash_commands.get(command, f"0x{command:02X}")
+    return f"CMD{command & 0x3F} " + sd_commands.get(command & 0x3F, "")
+
+
+def address_bytes(command, four_byte):
+    """Address bytes trace.c keeps after a flash command, 4 after 0xB7 for program, read and erases."""
+    if command in (0x02, 0x03, 0x20, 0x52, 0xD8):
+        return 4 if four_byte else 3
+    return 3 if command == 0x5A else 0
+
+
+def read_trace(path, ring=False):
+    """Read a host trace file, or with ring a memory dump of the firmware's struct trace."""
+    if not ring:
+        return np.fromfile(path, dtype=record_dtype)
+    data = np.fromfile(path, dtype=np.uint8)
+    count = int(data[0]) | int(data[1]) << 8
+    records = np.frombuffer(data[2:2 + ring_records * record_dtype.itemsize].tobytes(), dtype=record_dtype)
+    if count < ring_records:
+        return records[:count]
+    return np.roll(records, -(count % ring_records))
+
+
+def collapse(records):
+    """Merge runs of identical records apart from time, such as status polls, into (first record, count)."""
+    if not len(records):
+        return []
+    keys = np.stack([records[f].astype(np.int64) for f in ("device", "command", "address", "length")], axis=1)
+    starts = np.flatnonzero(np.concatenate(([True], np.any(keys[1:] != keys[:-1], axis=1))))
+    counts = np.diff(np.append(starts, len(records)))
+    return [(records[s], int(c)) for s, c in zip(starts, counts)]
+
+
+def format_record(record, count=1):
+    device = int(record["device"])
+    repeat = f" x{count}" if count > 1 else ""
+    return (f"{record['time'] / flashsim.timer_hz:10.4f} s  {device_names[device]:>5}  "
+            f"{command_name(device, int(record['command'])):<24} 0x{int(record['address']):08X} "
+            f"{int(record['length']):>6} B{repeat}")
+
+
+def record(songs, cluster_kb, worst, image_path=None):
+    """Load songs from a card image with the firmware's read_file() compiled for the host, with the flash model and
+    an emulated SD card, returning the trace of trace.c."""
+    trace = []
+    with tempfile.TemporaryDirectory() as directory:
+        library = sdcount.build(directory, trace=True)
+        image = image_path or os.path.join(directory, "card.img")
+        fat32.build_image(image, [(f"{i}.ULV", path) for i, path in enumerate(songs)], cluster_kb * 1024)
+
+        @ctypes.CFUNCTYPE(None, ctypes.POINTER(TraceRecord))
+        def sink(pointer):
+            r = pointer.contents
+            trace.append((r.time, r.address, r.length, r.device, r.command))
+
+        library.reset()
+        flash = flashsim.W25Q128(worst)
+        flashsim.Bus(library, flash)
+        library.variable(ctypes.c_void_p, "trace_sink").value = ctypes.cast(sink, ctypes.c_void_p).value
+        if library.library.sdcard_open(image.encode(), sdcount.access_bytes):
+            raise OSError(f"cannot open '{image}'")
+        try:
+            if library.run("startup"):
+                raise RuntimeError("startup() failed")
+            for i, path in enumerate(songs):
+                library.variable(ctypes.c_uint8, "file_num").value = i + 1
+                result = library.run("read_file", clocks=1000 * firmware.f_cpu)
+                if result:
+                    raise RuntimeError(f"read_file() of song {i + 1} returned {result}")
+
+                data = np.fromfile(path, dtype=np.uint8)
+                data = data[:4 + ulv.read_header(data).size]
+                if np.any(flash.memory[:len(data)] != data):
+                    flash.violation("flash differs from file")
+        finally:
+            library.library.sdcard_close()
+            library.variable(ctypes.c_void_p, "trace_sink").value = None
+
+    for reason, count in flash.violations.items():
+        print(f"VIOLATION: {reason} ({count}x)")
+    return np.array(trace, dtype=record_dtype)
+
+
+def replay(records, worst, image=None):
+    """Replay flash records against the flash model and SD card records against a card image."""
+    flash = flashsim.W25Q128(worst)
+    four_byte = False
+    early = 0
+    early_seconds = 0.0
+    tick = 1 / flashsim.timer_hz
+    for r in records[records["device"] == 0]:
+        command = int(r["command"])
+        length = int(r["length"])
+        flash.advance(max(0.0, r["time"] * tick - flash.time))
+
+        # Commands the chip would refuse while busy are delayed and counted
+        if command not in (0x05, 0x35, 0x75, 0x7A) and flash.busy:
+            if flash.busy_until - flash.time > tick:
+                early += 1
+                early_seconds += flash.busy_until - flash.time
+            flash.advance(flash.busy_until - flash.time)
+
+        count = address_bytes(command, four_byte)
+        address = int(r["address"])
+        flash.select()
+        flash.transfer(command)
+        for i in range(count):
+            flash.transfer(address >> (8 * (count - 1 - i)) & 0xFF)
+        flash.write([0x00 if command == 0x02 else 0xFF] * (length - 1 - count))
+        flash.deselect()
+        if command in (0xB7, 0xE9):
+            four_byte = command == 0xB7
+
+    print(f"Flash: {int(np.sum(records['device'] == 0))} transactions, busy {flash.busy_time:.2f} s, "
+          f"{int(np.sum(flash.erase_counts))} sector erases, at most {int(np.max(flash.erase_counts))} per sector")
+    if early:
+        print(f"  {early} commands were sent while the flash memory was busy, {early_seconds * 1e3:.1f} ms early")
+    for reason, count in flash.violations.items():
+        print(f"  VIOLATION: {reason} ({count}x)")
+    print("  Erases per 64 kB block, 1 MB per row:")
+    for row in flashsim.heatmap(flash.erase_counts):
+        print("    " + row)
+
+    sd = records[records["device"] == 1]
+    problems = early + sum(flash.violations.values())
+    reads = sd[(sd["command"] & 0x3F) == 17]
+    print(f"SD card: {len(sd)} transactions, {len(reads)} sector reads, {int(np.sum(sd['length']))} bytes clocked")
+    if image:
+        volume = fat32.read_volume(image)
+        size = os.path.getsize(image) // fat32.sector_bytes
+        sectors = reads["address"].astype(np.int64)
+        areas = (("boot", sectors < volume.fat_start),
+                 ("FAT", (sectors >= volume.fat_start) & (sectors < volume.data_start)),
+                 ("data", (sectors >= volume.data_start) & (sectors < size)))
+        print("  " + ", ".join(f"{name} {int(np.sum(mask))}" for name, mask in areas))
+        outside = int(np.sum(sectors >= size))
+        if outside:
+            print(f"  VIOLATION: {outside} reads beyond the end of the card")
+            problems += outside
+    return problems
+
+
+def summary(records):
+    """Transactions and bytes clocked per device and command."""
+    result = {}
+    for r in records:
+        key = (int(r["device"]), int(r["command"]))
+        count, length = result.get(key, (0, 0))
+        result[key] = (count + 1, length + int(r["length"]))
+    return result
+
+
+def diff(a, b, limit):
+    """Print differences of two traces per command and as aligned runs of records, returning the number of changes."""
+    sa, sb = summary(a), summary(b)
+    print(f"{'device':>6} {'command':<24} {'count A':>9} {'count B':>9} {'bytes A':>10} {'bytes B':>10}")
+    for key in sorted(set(sa) | set(sb)):
+        ca, la = sa.get(key, (0, 0))
+        cb, lb = sb.get(key, (0, 0))
+        mark = "" if (ca, la) == (cb, lb) else "  *"
+        print(f"{device_names[key[0]]:>6} {command_name(*key):<24} {ca:>9} {cb:>9} {la:>10} {lb:>10}{mark}")
+    for name, records in (("A", a), ("B", b)):
+        if len(records):
+            print(f"Trace {name} spans {(int(records['time'][-1]) - int(records['time'][0])) / flashsim.timer_hz:.3f} s")
+
+    # Align runs without times and repeat counts, status polls differ with timing only
+    ra, rb = collapse(a), collapse(b)
+    ka = [tuple(int(r[f]) for f in ("device", "command", "address", "length")) for r, _ in ra]
+    kb = [tuple(int(r[f]) for f in ("device", "command", "address", "length")) for r, _ in rb]
+
+    # Skip the common start and end, and align at most window runs from the first difference
+    start = 0
+    while start < min(len(ka), len(kb)) and ka[start] == kb[start]:
+        start += 1
+    end = 0
+    while end < min(len(ka), len(kb)) - start and ka[-1 - end] == kb[-1 - end]:
+        end += 1
+    window = 2000
+    stop_a, stop_b = min(len(ka) - end, start + window), min(len(kb) - end, start + window)
+    if stop_a - start == window or stop_b - start == window:
+        print(f"\nTraces differ over more than {window} runs, comparing only the first ones")
+
+    changes = 0
+    matcher = difflib.SequenceMatcher(None, ka[start:stop_a], kb[start:stop_b], autojunk=False)
+    for tag, i1, i2, j1, j2 in matcher.get_opcodes():
+        if tag == "equal":
+            continue
+        i1, i2, j1, j2 = i1 + start, i2 + start, j1 + start, j2 + start
+        changes += 1
+        if changes <= limit:
+            print(f"\n{tag} at run {i1} of A, {j1} of B:")
+            for r, count in ra[i1:i2][:10]:
+                print("  - " + format_record(r, count))
+            for r, count in rb[j1:j2][:10]:
+                print("  + " + format_record(r, count))
+            if max(i2 - i1, j2 - j1) > 10:
+                print(f"  ... {i2 - i1} runs in A, {j2 - j1} in B")
+    print(f"\n{changes} changed places in {len(ra)} and {len(rb)} runs of records")
+    return changes
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Record, replay and compare traces of SPI transactions to the "
+                                                 "flash memory and SD card.")
+    commands = parser.add_subparsers(dest="action", required=True)
+
+    p = commands.add_parser("record", help="trace loading songs from a card image into flash, using the "
+                                           "firmware compiled for the host, an emulated SD card and the flash model")
+    p.add_argument("songs", nargs="+", help="ULV files in play order")
+    p.add_argument("-o", "--output", required=True, help="trace file to write")
+    p.add_argument("--image", help="keep the card image in this file, for replay")
+    p.add_argument("--cluster-kb", type=int, default=32, help="cluster size in kB (default 32)")
+    p.add_argument("--worst", action="store_true", help="use maximum flash timings")
+
+    p = commands.add_parser("show", help="print a trace, merging repeated records")
+    p.add_argument("trace", help="trace file")
+    p.add_argument("--ring", action="store_true", help="trace is a memory dump of the firmware's trace ring")
+
+    p = commands.add_parser("replay", help="replay a trace against the flash model and a card image")
+    p.add_argument("trace", help="trace file")
+    p.add_argument("--ring", action="store_true", help="trace is a memory dump of the firmware's trace ring")
+    p.add_argument("--image", help="card image the trace was recorded with")
+    p.add_argument("--worst", action="store_true", help="use maximum flash timings")
+
+    p = commands.add_parser("diff", help="compare two traces")
+    p.add_argument("a", help="trace before a change")
+    p.add_argument("b", help="trace after a change")
+    p.add_argument("--ring", action="store_true", help="traces are memory dumps of the firmware's trace ring")
+    p.add_argument("--limit", type=int, default=20, help="changed places to print (default 20)")
+    args = parser.parse_args()
+
+    start = time.perf_counter()
+    result = 0
+    if args.action == "record":
+        records = record(args.songs, args.cluster_kb, args.worst, args.image)
+        records.tofile(args.output)
+        print(f"Wrote {len(records)} records to '{args.output}' in {time.perf_counter() - start:.1f} s")
+    elif args.action == "show":
+        for r, count in collapse(read_trace(args.trace, args.ring)):
+            print(format_record(r, count))
+    elif args.action == "replay":
+        result = replay(read_trace(args.trace, args.ring), args.worst, args.image) > 0
+    else:
+        result = diff(read_trace(args.a, args.ring), read_trace(args.b, args.ring), args.limit) > 0
+    return 1 if result else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,235 @@
+import math
+from dataclasses import dataclass
+
+import numpy as np
+
+# ULV header fields, see "ULV file spefication.md" in the Firmware directory
+ulv_extended = 0x80000000
+ulv_size_mask = 0x7FFFFFFF
+ulv_loading = 0xFF  # Highest size byte while the firmware is loading a song
+ulv_header_length = 6
+ulv_half_rate = 0x01
+ulv_rle = 0x02
+ulv_mulaw = 0x04
+ulv_paged = 0x08
+ulv_pwm = 0x10
+ulv_rate = 29840
+ulv_min_rate = 153  # Lowest rate whose sample clock period of the 10 MHz CPU clock fits in 16 bits
+ulv_frame = 1492
+pwm_channels = 3
+flag_names = {ulv_half_rate: "half-rate", ulv_rle: "rle", ulv_mulaw: "mulaw", ulv_paged: "paged", ulv_pwm: "pwm"}
+
+
+class UlvError(Exception):
+    pass
+
+
+@dataclass
+class UlvHeader:
+    size: int  # N, bytes after the 4-byte size field
+    length: int  # L, extended header bytes, 0 for ULV 1.0
+    flags: int
+    rate: int
+    frame: int  # F, audio samples per mech byte
+
+    @property
+    def version(self):
+        return "1.1" if self.length else "1.0"
+
+    @property
+    def mech_length(self):
+        """Bytes at the start of a frame before its audio samples."""
+        return 1 + (pwm_channels if self.flags & ulv_pwm else 0)
+
+    @property
+    def stored_rate(self):
+        return self.rate / 2 if self.flags & ulv_half_rate else self.rate
+
+    @property
+    def data_offset(self):
+        return 4 + self.length
+
+
+def open_ulv(path):
+    """Memory-map a ULV file as bytes."""
+    try:
+        return np.memmap(path, dtype=np.uint8, mode="r")
+    except ValueError:  # Empty file cannot be mapped
+        return np.zeros(0, dtype=np.uint8)
+
+
+def read_header(buf):
+    """Parse size field and extended header like the firmware's read_header."""
+    if len(buf) < 4:
+        raise UlvError(f"file has {len(buf)} bytes, shorter than the 4-byte header")
+    size = int.from_bytes(bytes(buf[:4]), "little")
+    if size >> 24 == ulv_loading:
+        raise UlvError("size field has the loading sentinel 0xFF in its highest byte")
+    if not size & ulv_extended:
+        return UlvHeader(size, 0, 0, ulv_rate, ulv_frame)
+
+    size &= ulv_size_mask
+    if len(buf) < 4 + ulv_header_length:
+        raise UlvError("file ends inside the extended header")
+    length, flags = int(buf[4]), int(buf[5])
+    rate = int(buf[6]) | int(buf[7]) << 8
+    frame = int(buf[8]) | int(buf[9]) << 8
+    if length < ulv_header_length or size < length:
+        raise UlvError(f"invalid extended header length {length}")
+    if rate < ulv_min_rate:
+        raise UlvError(f"sample rate {rate} Hz is below {ulv_min_rate} Hz")
+    if frame < 2:
+        raise UlvError(f"invalid frame length {frame}")
+    return UlvHeader(size, length, flags, rate, frame)
+
+
+def read_frames(buf, header):
+    """Locate frames, returning mech byte offsets, stored samples per frame and structure problems."""
+    start = header.data_offset
+    end = min(len(buf), 4 + header.size)
+    problems = []
+    if start >= end:
+        return np.zeros(0, dtype=np.int64), np.zeros(0, dtype=np.int64), ["no frames"]
+
+    if not header.flags & ulv_rle:
+        # Fixed stride, the last frame may be short
+        stride = header.mech_length + header.frame
+        offsets = np.arange(start, end, stride, dtype=np.int64)
+        samples = np.full(len(offsets), header.frame, dtype=np.int64)
+        samples[-1] = end - offsets[-1] - header.mech_length
+        if samples[-1] < 0:
+            problems.append("last frame ends inside its mech bytes")
+            samples[-1] = 0
+        return offsets, samples, problems
+
+    # Escapes are the only 0 audio bytes, so the walk jumps from escape to escape
+    data = bytes(buf[:end])
+    offsets = []
+    samples = []
+    halves = ((header.frame + 1) // 2, header.frame // 2)
+    pos = start
+    while pos < end:
+        offsets.append(pos)
+        pos += header.mech_length
+        decoded = 0
+        for half in halves:
+            need = half
+            while need > 0 and pos < end:
+                escape = data.find(b"\0", pos, min(end, pos + need))
+                if escape < 0:
+                    step = min(end, pos + need) - pos
+                    need -= step
+                    pos += step
+                    break
+                need -= escape - pos
+                if escape + 1 >= end:
+                    problems.append(f"escape at {escape} has no count")
+                    pos = end
+                    break
+                count = data[escape + 1]
+                if count == 0:
+                    problems.append(f"run count 0 at {escape + 1}")
+                elif count > need:
+                    problems.append(f"run at {escape} crosses mech sample")
+                need -= max(count, 1)
+                pos = escape + 2
+            decoded += half - max(need, 0)
+        samples.append(decoded)
+        if len(problems) > 10:
+            problems.append("too many problems, stopped")
+            break
+    return np.array(offsets, dtype=np.int64), np.array(samples, dtype=np.int64), problems
+
+
+def read_mech(buf, header, offsets):
+    """Return mech bytes and PWM duty bytes (or None) of frames."""
+    offsets = offsets[offsets < len(buf)]
+    mech = np.asarray(buf[offsets])
+    if not header.flags & ulv_pwm:
+        return mech, None
+    index = offsets[:, None] + 1 + np.arange(pwm_channels)
+    return mech, np.asarray(buf[np.minimum(index, len(buf) - 1)])
+
+
+def duration(header, samples):
+    """Playback duration in seconds of stored samples."""
+    return int(np.sum(samples)) / header.stored_rate
+
+
+def flash_blocks(header):
+    """64 kB flash blocks erased when loading."""
+    return math.ceil((4 + header.size) / 65536)
+
+
+def mulaw_table():
+    """G.711 mu-law codes to DAC samples with 8 fractional bits, as in the firmware's mulaw.c."""
+    code = ~np.arange(256) & 0xFF
+    magnitude = ((((code & 0x0F) << 3) + 0x84) << ((code >> 4) & 0x07)) - 0x84
+    linear = np.where(code & 0x80, -magnitude, magnitude)
+    return ((linear + 32768) * 255 // 256).astype(np.int64)
+
+
+def read_audio(buf, header, offsets):
+    """Gather the audio bytes of all frames into one array."""
+    end = min(len(buf), 4 + header.size)
+    starts = offsets + header.mech_length
+    lengths = np.maximum(np.append(offsets[1:], end) - starts, 0)
+    before = np.cumsum(lengths) - lengths
+    index = np.repeat(starts - before, lengths) + np.arange(int(np.sum(lengths)))
+    return np.asarray(buf[index])
+
+
+def dac_output(header, audio):
+    """DAC values the firmware's play() writes for the audio bytes of a song, one per sample clock."""
+    if header.flags & ulv_rle:
+        escape = audio == 0
+        count = np.zeros(len(audio), dtype=bool)
+        count[1:] = escape[:-1]
+        plain = ~escape & ~count
+    else:
+        escape = np.zeros(len(audio), dtype=bool)
+        plain = np.ones(len(audio), dtype=bool)
+
+    # Stored samples with 8 fractional bits
+    codes = audio[plain]
+    values = mulaw_table()[codes] if header.flags & ulv_mulaw else codes.astype(np.int64) << 8
+
+    # Half rate plays the midpoint to the previous sample first
+    step = 2 if header.flags & ulv_half_rate else 1
+    if step == 2:
+        previous = np.concatenate(([0x8000], values[:-1]))
+        values = np.stack(((previous >> 1) + (values >> 1), values), axis=1).reshape(-1)
+
+    # Requantise with error feedback, the carried error is the fraction of the running sum
+    total = np.cumsum(values)
+    played = (total >> 8) - np.concatenate(([0], total[:-1] >> 8))
+
+    if not np.any(escape):
+        return played.astype(np.uint8)
+
+    # Runs hold the last DAC value for count samples without feeding back the error
+    position = np.flatnonzero(plain)
+    keys = np.repeat(position * 2, step) + np.tile(np.arange(step), len(position))
+    runs = np.flatnonzero(escape)
+    held_index = np.searchsorted(position, runs) * step - 1
+    held = np.where(held_index >= 0, played[np.maximum(held_index, 0)], 0x80)
+    order = np.argsort(np.concatenate((keys, runs * 2 + 1)), kind="stable")
+    out_values = np.concatenate((played, held))[order]
+    out_lengths = np.concatenate((np.ones(len(played), dtype=np.int64),
+                                  audio[runs + 1].astype(np.int64) * step))[order]
+    return np.repeat(out_values, out_lengths).astype(np.uint8)
+
+
+def mech_timeline(header, offsets, samples, mech, pwm=None):
+    """Times in seconds and duties (0-255) of mech samples as played, 2 per frame."""
+    starts = np.cumsum(samples) - samples
+    first = (header.frame + 1) // 2
+    times = np.stack((starts, starts + first), axis=1).astype(float) / header.stored_rate
+    nibbles = np.stack((mech & 0x0F, mech >> 4), axis=1)
+    duties = ((nibbles[:, :, None] >> np.arange(4)) & 1) * 255
+    if pwm is not None:
+        duties[:, :, :pwm_channels] = duties[:, :, :pwm_channels] * pwm[:, None, :] // 255
+
+    # Second mech sample of a short last frame is not played
+    played = np.stack((np.ones(len(samples), dtype=bool), samples > first), axis=1)
+    return times[played], duties[played]